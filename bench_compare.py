@@ -0,0 +1,66 @@
+import argparse
+import json
+import sys
+from pathlib import Path
+
+# Compares two result files written by the bench target, e.g.
+#   bench --benchmark_out=results.json --benchmark_out_format=json
+# and fails if some benchmark got slower than the threshold allows.
+
+TIME_UNITS_NS = {"ns": 1, "us": 1e3, "ms": 1e6, "s": 1e9}
+
+
+def load_times(path, statistic):
+    results = json.loads(Path(path).read_text())
+    times = {}
+    for bench in results["benchmarks"]:
+        if bench.get("aggregate_name") != statistic:
+            continue
+        times[bench["run_name"]] = (
+            bench["real_time"] * TIME_UNITS_NS[bench["time_unit"]]
+        )
+    return times
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("baseline", type=Path)
+    parser.add_argument("current", type=Path)
+    parser.add_argument(
+        "-s",
+        "--statistic",
+        default="p50",
+        help="aggregate compared: p50, p90, mean, median or stddev",
+    )
+    parser.add_argument(
+        "-t",
+        "--threshold",
+        type=float,
+        default=0.1,
+        help="relative slowdown reported as a regression",
+    )
+    args = parser.parse_args()
+
+    baseline = load_times(args.baseline, args.statistic)
+    current = load_times(args.current, args.statistic)
+
+    regressions = 0
+    for name in sorted(baseline.keys() & current.keys()):
+        change = current[name] / baseline[name] - 1
+        flag = ""
+        if change > args.threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        print(
+            f"{name}: {baseline[name]:,.0f}ns -> {current[name]:,.0f}ns "
+            f"({change:+.1%}){flag}"
+        )
+    for name in sorted(baseline.keys() - current.keys()):
+        print(f"{name}: missing from {args.current}")
+
+    print(f"{regressions} regressions over {args.threshold:.0%}")
+    sys.exit(1 if regressions > 0 else 0)
+
+
+if __name__ == "__main__":
+    main()
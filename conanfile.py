@@ -8,6 +8,7 @@ class CompressorRecipe(ConanFile):
     def requirements(self):
         self.requires("boost/1.83.0")
         self.requires("gtest/1.14.0")
+        self.requires("benchmark/1.8.3")
 
     def generate(self):
         CMakeDeps(self).generate()
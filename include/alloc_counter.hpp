@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstddef>
+
+// Number of global operator new calls made by the process so far. Only
+// available in binaries that link src/alloc_counter.cpp.
+std::size_t allocation_count();
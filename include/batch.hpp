@@ -0,0 +1,53 @@
+#pragma once
+
+#include "nonogram.hpp"
+
+#include <functional>
+
+struct BatchOptions {
+  SolverOptions m_solver;
+  // puzzles solved at the same time
+  int m_jobs{1};
+  // report results in input order rather than as they complete
+  bool m_ordered{true};
+  // if not 0, count solutions up to this limit instead of finding one
+  long m_solution_limit{0};
+  // measure the propagation time in each result's stats
+  bool m_time_phases{false};
+};
+
+struct BatchResult {
+  // position of the puzzle in the input
+  int m_index;
+  bool m_solved;
+  SolveStatus m_status;
+  long m_solve_ns;
+  // solutions counted, if counting
+  long m_solution_count;
+  SolverStats m_stats;
+  // first solution found, or the grid reached without one; always set once
+  // the puzzle is solved
+  std::optional<Solution> m_solution;
+};
+
+struct BatchSummary {
+  int m_puzzles{0};
+  int m_solved{0};
+  long m_wall_ns{0};
+};
+
+// Returns the next puzzle of the batch, or nullopt at its end
+using PuzzleSource = std::function<std::optional<Puzzle>()>;
+
+// Takes puzzles from next_puzzle until its end and solves them on
+// options.m_jobs threads while the following puzzles are parsed. on_result is
+// called once per puzzle, never concurrently. Puzzles share cache if given,
+// and one set of placement tables if m_placement_table_cells is not 0.
+BatchSummary solve_batch(const PuzzleSource &next_puzzle,
+                         const BatchOptions &options,
+                         const std::function<void(BatchResult &)> &on_result,
+                         LineCache *cache = nullptr);
+// Same as above, reading concatenated puzzles from input
+BatchSummary solve_batch(std::istream &input, const BatchOptions &options,
+                         const std::function<void(BatchResult &)> &on_result,
+                         LineCache *cache = nullptr);
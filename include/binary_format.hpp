@@ -0,0 +1,87 @@
+#pragma once
+
+#include "nonogram.hpp"
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// Binary corpora of puzzles or solutions, version 1. All integers are little
+// endian.
+//
+//   header   4 byte magic ("NGPZ" or "NGSL"), u32 version
+//   records  one per puzzle or solution, see below
+//   index    u64 file offset of every record
+//   trailer  u64 record count, u64 offset of the index
+//
+// A puzzle record is varint width, varint height, then for every column and
+// then every row the varint number of rules followed by the varint rules. A
+// solution record is varint width, varint height, a flag byte that is 1 if
+// the grid is solved, and for solved grids the cells row by row, one bit per
+// cell set if FILLED, least significant bit first.
+enum class BinaryKind : std::uint32_t {
+  PUZZLES,
+  SOLUTIONS,
+};
+
+// Malformed binary input
+struct BinaryFormatError : std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+// Grid read back from a solution record
+struct SolutionGrid {
+  bool m_solved;
+  int m_width;
+  int m_height;
+  // empty unless solved
+  std::vector<CellsLine> m_rows;
+};
+
+// Whether data starts like a binary file of the given kind
+bool is_binary(std::string_view data, BinaryKind kind);
+
+// Streams records of one kind to os. The index is written by finish(), which
+// must be called once after the last record.
+struct BinaryWriter {
+  BinaryWriter(std::ostream &os, BinaryKind kind);
+
+  void add(const Puzzle &puzzle);
+  // Only cells of final solutions are written
+  void add(const Solution &solution);
+  void finish();
+
+  std::ostream &m_os;
+  BinaryKind m_kind;
+  std::uint64_t m_offset{0};
+  std::vector<std::uint64_t> m_offsets;
+  // record being encoded
+  std::string m_record;
+
+private:
+  void write_record();
+};
+
+// Random access to the records of a binary file held in memory, e.g. by a
+// MappedFile. Opening only checks the header and the trailer; records are
+// decoded on access. Throws BinaryFormatError.
+struct BinaryReader {
+  BinaryReader(std::string_view data, BinaryKind kind);
+
+  size_t size() const { return m_count; }
+  Puzzle puzzle(size_t n) const;
+  SolutionGrid solution(size_t n) const;
+
+  std::string_view m_data;
+  BinaryKind m_kind;
+  size_t m_count;
+  // m_count little endian u64 offsets
+  const char *m_index;
+
+private:
+  std::string_view record(size_t n) const;
+};
+
+// Prints the grid like print_solution
+void print_solution(std::ostream &os, const SolutionGrid &grid);
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "packed_line.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Cells of a grid as FILLED and EMPTY bit planes, like PackedLine, stored
+// twice: row-major, and transposed so that every column is contiguous too.
+// Line writes go to one orientation only and leave their 64x64 block stale
+// in the other, which sync_row and sync_column bring up to date with
+// bit-matrix transposes, so a pass over the rows does not scatter writes
+// over every column. A block is stale in at most one orientation.
+struct BitGrid {
+  using Word = PackedLine::Word;
+  static constexpr int kBlockBits = PackedLine::kWordBits;
+
+  enum class BlockState : std::uint8_t {
+    FRESH,
+    ROWS_STALE,    // the column orientation is newer
+    COLUMNS_STALE, // the row orientation is newer
+  };
+
+  BitGrid() = default;
+  BitGrid(int width, int height);
+
+  Cell get(int i, int j) const;
+  // Writes a cell in both orientations, or only in the newer one if its
+  // block is stale
+  void set(int i, int j, Cell value);
+  // Writes a cell through row i, leaving the column orientation stale
+  void set_in_row(int i, int j, Cell value);
+  // Writes a cell through column j, leaving the row orientation stale
+  void set_in_column(int i, int j, Cell value);
+
+  // Bring every block crossed by row i or column j up to date
+  void sync_row(int i);
+  void sync_column(int j);
+
+  // Copy row i or column j, which must be in sync, into line
+  void load_row(int i, PackedLine &line) const;
+  void load_column(int j, PackedLine &line) const;
+
+  // Bytes held by the bit planes and the block states
+  size_t memory_bytes() const;
+
+  int m_width{0};
+  int m_height{0};
+  // Words per row and per column
+  int m_row_words{0};
+  int m_column_words{0};
+  // Row i holds words [i * m_row_words, (i + 1) * m_row_words)
+  std::vector<Word> m_row_filled;
+  std::vector<Word> m_row_empty;
+  // Column j holds words [j * m_column_words, (j + 1) * m_column_words)
+  std::vector<Word> m_column_filled;
+  std::vector<Word> m_column_empty;
+  // Block (bi, bj) covers rows [64 bi, 64 bi + 64) and columns
+  // [64 bj, 64 bj + 64), at index bi * m_row_words + bj
+  std::vector<BlockState> m_blocks;
+
+private:
+  BlockState &block(int i, int j) {
+    return m_blocks[(i / kBlockBits) * m_row_words + j / kBlockBits];
+  }
+  BlockState block(int i, int j) const {
+    return m_blocks[(i / kBlockBits) * m_row_words + j / kBlockBits];
+  }
+  void write_row_bits(int i, int j, Cell value);
+  void write_column_bits(int i, int j, Cell value);
+  void transpose_to_rows(int bi, int bj);
+  void transpose_to_columns(int bi, int bj);
+};
+
+// Transposes a 64x64 bit matrix in place: bit c of word r becomes bit r of
+// word c
+void transpose_block(BitGrid::Word block[BitGrid::kBlockBits]);
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "nonogram.hpp"
+
+#include <random>
+
+struct GeneratorOptions {
+  int m_width{10};
+  int m_height{10};
+  // probability of every cell being filled
+  double m_density{0.5};
+};
+
+// Puzzle whose rules are the runs of a random grid
+Puzzle generate_puzzle(const GeneratorOptions &options, std::mt19937_64 &rng);
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "nonogram.hpp"
+
+#include <span>
+#include <vector>
+
+// Nogoods learned from conflicts: sets of cell values that no solution has
+// all of. They only follow from the puzzle, so they hold in every branch.
+//
+// Each nogood of two or more literals watches two of them that do not hold,
+// and is only looked at when the cell of one of those is fixed: it then
+// watches another, or fixes the last one. Cells are found on the trail, so
+// the solution must be recording.
+struct Nogoods {
+  struct Literal {
+    int m_i;
+    int m_j;
+    Cell m_value;
+  };
+
+  // Longer nogoods seldom come up again, and cost as much to check
+  static constexpr size_t kMaxLiterals = 16;
+
+  Nogoods(size_t capacity, int width, int height);
+
+  // Adds a nogood unless the store is full or the nogood is too long.
+  // Returns whether it was added. It is checked in full by the next
+  // propagate.
+  bool add(std::span<const Literal> literals);
+
+  std::span<const Literal> get(int k) const;
+  size_t size() const { return m_starts.size() - 1; }
+
+  // Sets the only unknown cell of every nogood whose other cells all hold
+  // to its other value, with the nogood as reason. Returns false, with the
+  // nogood in solution.m_conflict, if all cells of one hold.
+  bool propagate(Solution &solution, SolverStats &stats);
+
+  size_t m_capacity;
+  int m_width;
+  // nogood k is m_literals[m_starts[k], m_starts[k + 1])
+  std::vector<size_t> m_starts{0};
+  std::vector<Literal> m_literals;
+  // Watch 2k + w of nogood k is on literal m_watched[2k + w]. The watches on
+  // a cell are linked from m_first_watch through m_next_watch, -1 ending.
+  std::vector<size_t> m_watched;
+  std::vector<int> m_next_watch;
+  std::vector<int> m_first_watch;
+  // nogoods of one literal, which are checked every time
+  std::vector<int> m_units;
+  // nogoods to check in full, and to link watches for
+  std::vector<int> m_pending;
+  // Trail position and nogood of every full check that left a watch on a
+  // literal that holds; undoing past the position checks the nogood again
+  std::vector<std::pair<size_t, int>> m_rechecks;
+  // trail entries whose cells have been looked at
+  size_t m_checked{0};
+
+private:
+  int cell_index(const Literal &literal) const {
+    return literal.m_i * m_width + literal.m_j;
+  }
+  void link_watch(int watch);
+  void unlink_watch(int watch);
+  // Sets watches for nogood k from scratch. Returns false on a conflict.
+  bool check(Solution &solution, int k, SolverStats &stats);
+  // Handles the cell of watch becoming its literal's value. Returns false
+  // on a conflict, and whether the watch moved to another cell in moved.
+  bool on_watch_held(Solution &solution, int watch, bool &moved,
+                     SolverStats &stats);
+};
+
+// Finds the branch decisions that a failed propagation follows from, by
+// walking the trail back from solution.m_conflict and expanding the reason
+// of every cell it reaches. A cell fixed by a line solve follows from a
+// minimal set of the cells of the line fixed before it, found by solving the
+// line again without them one at a time; a cell without a known reason
+// follows from every decision before it.
+struct ConflictAnalysis {
+  // Past this many cells, the rest of the conflict is taken to follow from
+  // every decision before them. Explaining a cell takes a line solve per
+  // cell of its line, and long walks seldom reach back much further.
+  static constexpr int kMaxExplainedCells = 16;
+
+  explicit ConflictAnalysis(const Solution &solution);
+
+  // decision_marks[d] is the trail position of decision d. Returns the d of
+  // the decisions the conflict follows from, in increasing order; none if
+  // it follows from the puzzle alone.
+  std::vector<int> decisions(const Solution &solution,
+                             std::span<const size_t> decision_marks,
+                             const Nogoods &nogoods);
+
+  // Marks a minimal set of the cells of line fixed before trail position
+  // limit from which solving the line still fixes the cell at limit, or
+  // still fails if limit is the end of the trail
+  void explain_line(const Solution &solution, int line, long limit);
+
+  int m_width;
+  // every line as before any cell was fixed, whose fits explanations reuse
+  std::vector<LineState> m_lines;
+  // trail position of every cell on the trail, -1 for the others
+  std::vector<long> m_positions;
+  // trail entries the conflict follows from
+  std::vector<char> m_marked;
+  // the line being explained, and its cells that may be left out
+  PackedLine m_line;
+  std::vector<int> m_candidates;
+  UpdateResult m_result;
+};
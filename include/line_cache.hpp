@@ -0,0 +1,58 @@
+#pragma once
+
+#include "nonogram.hpp"
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Bounded memo of update_cells results, keyed by the rules and the packed
+// cells of a line. update_cells does not depend on anything else, so entries
+// are shared by every search branch, thread and puzzle using the cache.
+// Least recently used entries are evicted first.
+struct LineCache {
+  explicit LineCache(size_t capacity);
+
+  // Fills result and returns true if the line is cached
+  bool lookup(const RulesLine &rules, const PackedLine &cells,
+              UpdateResult &result);
+  void insert(const RulesLine &rules, const PackedLine &cells,
+              const UpdateResult &result);
+
+  // Number of cached lines; not synchronized with concurrent inserts
+  size_t size() const;
+
+  struct Value {
+    bool m_rules_fit;
+    bool m_line_updated;
+    bool m_line_solved;
+    // updated cells, 2 bits per cell
+    std::string m_cells;
+    std::vector<int> m_lfit;
+    std::vector<int> m_rfit;
+  };
+
+  struct Entry {
+    std::string m_key;
+    Value m_value;
+  };
+
+  struct Shard {
+    std::mutex m_mutex;
+    // most recently used first
+    std::list<Entry> m_lru;
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> m_index;
+  };
+
+  static constexpr int kShards = 16;
+
+  size_t m_shard_capacity;
+  Shard m_shards[kShards];
+
+  std::atomic<long> m_hits{0};
+  std::atomic<long> m_misses{0};
+  std::atomic<long> m_evictions{0};
+};
@@ -1,7 +1,15 @@
 #pragma once
 
+#include "bit_grid.hpp"
+#include "packed_line.hpp"
+
+#include <array>
+#include <chrono>
 #include <iostream>
 #include <optional>
+#include <queue>
+#include <span>
+#include <tuple>
 #include <vector>
 
 using Rule = int;
@@ -9,6 +17,9 @@ using Rule = int;
 using RulesLine = std::vector<Rule>;
 
 struct Puzzle {
+  // Longest side the parsers accept
+  static constexpr int kMaxSide = 1 << 15;
+
   Puzzle(int width, int height);
 
   int m_width;
@@ -18,56 +29,200 @@ struct Puzzle {
 };
 
 Puzzle read_puzzle(std::istream &is);
+// Reads the next of several concatenated puzzles, skipping blank lines before
+// its header. Returns nullopt at the end of input. Checks the input like
+// PuzzleParser and throws ParseError; line_no, if given, is the 1-based line
+// of is and is moved past the lines read.
+std::optional<Puzzle> read_next_puzzle(std::istream &is,
+                                       int *line_no = nullptr);
+// Writes puzzle in the format read by read_puzzle
+void write_puzzle(std::ostream &os, const Puzzle &puzzle);
 void print_puzzle(std::ostream &os, const Puzzle &puzzle);
 
-enum class Cell { UNKNOWN, FILLED, EMPTY };
-
 char print_cell(Cell c);
 
 using CellsLine = std::vector<Cell>;
 
-struct SolutionLine {
+// Rules, fits and solved flag of a row or column; a Solution keeps the cells
+// in its grid
+struct LineState {
   RulesLine m_rules;
-  CellsLine m_cells;
+  int m_size;
   bool m_solved_flg;
   std::vector<int> m_lfit;
   std::vector<int> m_rfit;
   std::vector<int> m_lfit_reversed;
   std::vector<int> m_rfit_reversed;
 
-  SolutionLine(int size, const RulesLine &rules);
+  LineState(int size, const RulesLine &rules);
   void update_fits(std::vector<int> &&lfit, std::vector<int> &&rfit);
+  // Copies the fits into the line's existing storage
+  void assign_fits(std::span<const int> lfit, std::span<const int> rfit);
   const size_t size() const;
 };
 
+// A line that holds its own cells, solved on its own
+struct SolutionLine : LineState {
+  SolutionLine(int size, const RulesLine &rules);
+
+  CellsLine m_cells;
+};
+
+// Order in which propagation visits lines that have changed
+enum class PropagationOrder {
+  SWEEP,       // all columns, then all rows, skipping unchanged lines
+  FIFO,        // in the order the lines changed
+  NEWLY_FIXED, // most cells fixed since the line was last solved first
+  SLACK,       // smallest total slack (rfit - lfit) first
+};
+
+// Priority queue of lines waiting to be solved. Lines are numbered rows
+// first: row i is line i, column j is line height + j. A line is queued at
+// most once; pushing a queued line only raises its priority.
+struct LineQueue {
+  LineQueue(int n_lines, PropagationOrder order);
+
+  void push(int line, int priority);
+  std::optional<int> pop();
+  bool is_queued(int line) const { return m_queued[line]; }
+
+  struct Entry {
+    int m_priority;
+    long m_sequence;
+    int m_line;
+
+    bool operator<(const Entry &other) const {
+      if (m_priority != other.m_priority) {
+        return m_priority < other.m_priority;
+      }
+      return m_sequence > other.m_sequence;
+    }
+  };
+
+  PropagationOrder m_order;
+  long m_sequence{0};
+  // pushes of lines that were already queued
+  long m_coalesced{0};
+  std::priority_queue<Entry> m_heap;
+  std::vector<bool> m_queued;
+  // sequence number of the live heap entry of each queued line
+  std::vector<long> m_live_sequence;
+};
+
+// Log of the changes made to a Solution, so that the search can modify it in
+// place and undo back to a checkpoint when it backtracks
+struct Trail {
+  // Why a cell was fixed: the line whose solve fixed it, or one of these
+  static constexpr int kDecision = -1;
+  // anything fixed before it may be the reason, as for probing
+  static constexpr int kUnknownReason = -2;
+  // learned nogood k is kFirstNogood - k
+  static constexpr int kFirstNogood = -3;
+
+  struct Entry {
+    enum class Kind { CELL, FITS, SOLVED };
+
+    Kind m_kind;
+    // CELL: row and column; FITS: line and offset into m_fits; SOLVED: line
+    int m_a;
+    int m_b;
+    Cell m_old_cell;
+    // CELL: reason the cell was fixed
+    int m_reason{kUnknownReason};
+  };
+
+  size_t mark() const { return m_entries.size(); }
+
+  std::vector<Entry> m_entries;
+  // Lowest mark undone to since learned nogoods last looked at the trail, so
+  // that they can look at the cells fixed again after it
+  size_t m_undone_to{0};
+  // previous lfit followed by previous rfit, for every FITS entry
+  std::vector<int> m_fits;
+};
+
+struct UpdateResult;
+
+// Outcome of a solve
+enum class SolveStatus {
+  SOLVED,
+  UNSOLVABLE,
+  // the time or node limit ran out; the grid holds the cells fixed by the
+  // root propagation, which hold in every solution
+  TIMED_OUT,
+};
+
 struct Solution {
   Solution(int width, int height, const std::vector<RulesLine> &vertical_rules,
-           const std::vector<RulesLine> &horizontal_rules);
+           const std::vector<RulesLine> &horizontal_rules,
+           PropagationOrder order = PropagationOrder::FIFO);
 
   const Cell get_cell(int i, int j) const;
-  void set_cell(int i, int j, Cell value);
+  // Sets a cell and queues both lines crossing it if the value changed. The
+  // reason is logged on the trail.
+  void set_cell(int i, int j, Cell value, int reason = Trail::kUnknownReason);
 
-  void set_row(int i, const CellsLine &line, std::vector<int> &&lfit,
-               std::vector<int> &&rfit);
-  void set_column(int j, const CellsLine &line, std::vector<int> &&lfit,
-                  std::vector<int> &&rfit);
+  // Copies the updated cells and fits of a successful update. Returns the
+  // number of cells that changed.
+  int set_row(int i, const UpdateResult &update);
+  int set_column(int j, const UpdateResult &update);
 
-  const SolutionLine &get_row(int i) const;
-  const SolutionLine &get_column(int j) const;
+  const LineState &get_row(int i) const;
+  const LineState &get_column(int j) const;
+  const LineState &get_line(int line) const;
+
+  // Brings a line of the grid up to date, which load_line needs
+  void sync_line(int line);
+  // Copies a synced line of the grid into cells
+  void load_line(int line, PackedLine &cells) const;
+  // Copies a line of the grid out as cells
+  CellsLine line_cells(int line) const;
 
   void mark_row_solved(int i);
   void mark_column_solved(int j);
 
+  // While recording, every change is logged on m_trail
+  void start_recording();
+  void stop_recording();
+  // Reverts the changes logged since mark. The state at mark must have been
+  // a propagation fixpoint: the queue is emptied and all lines are clean.
+  void undo_to(size_t mark);
+
   const bool is_row_solved(int i) const;
   const bool is_column_solved(int j) const;
 
+  int row_line(int i) const { return i; }
+  int column_line(int j) const { return m_height + j; }
+
   int m_width;
   int m_height;
 
   bool m_is_final;
+  SolveStatus m_status{SolveStatus::UNSOLVABLE};
+
+  // Cells as bit planes, in both orientations
+  BitGrid m_grid;
+  std::vector<LineState> m_rows_;
+  std::vector<LineState> m_columns_;
 
-  std::vector<SolutionLine> m_rows_;
-  std::vector<SolutionLine> m_columns_;
+  // Cells fixed in each line since it was last solved; every line starts
+  // dirty
+  std::vector<int> m_line_changes;
+  LineQueue m_queue;
+
+  bool m_recording{false};
+  Trail m_trail;
+  // Reason of the last failed propagation, as on the trail: the line that
+  // did not fit its rules, or the nogood that held
+  int m_conflict{Trail::kUnknownReason};
+
+private:
+  LineState &line_at(int line);
+  void record_cell(int i, int j, int reason);
+  void record_fits(int line);
+  void record_solved(int line);
+  int line_priority(int line) const;
+  void mark_line_changed(int line);
 };
 
 void print_solution(std::ostream &os, const Solution &solution);
@@ -86,8 +241,235 @@ struct UpdateResult {
   CellsLine m_cells;
   std::optional<std::vector<int>> m_lfit{std::nullopt};
   std::optional<std::vector<int>> m_rfit{std::nullopt};
+  // fitting DP states filled to compute the result; lines of up to 64 cells
+  // count one per rule and direction, each covering every start at once, and
+  // lines solved from a placement table count none
+  long m_dp_states{0};
+  // Fits of a line longer than 64 cells computed by the DP, and kept from
+  // the line's previous solve because its cells still allow them
+  int m_fits_computed{0};
+  int m_fits_reused{0};
 };
 
+struct PlacementTable;
+struct PlacementTables;
+
 UpdateResult update_cells(const RulesLine &rules, const SolutionLine &line);
+// Same as above, but reuses the buffers already held by result. If given, the
+// line is solved from table, which must hold the placements of its rules.
+void update_cells(const RulesLine &rules, const SolutionLine &line,
+                  UpdateResult &result,
+                  const PlacementTable *table = nullptr);
+// Same as above, for cells already packed. The fits of line are reused where
+// the cells allow them, so they must have been found for some of the cells,
+// like the fits of a new LineState.
+void update_cells(const LineState &line, const PackedLine &cells,
+                  UpdateResult &result);
+
+// Which unknown cell the search branches on
+enum class BranchCell {
+  FIRST,                 // first in row-major order
+  MOST_CONSTRAINED_LINE, // first of the unsolved line with least slack
+  MOST_CANDIDATE_BLOCKS, // covered by the most row and column block windows
+};
+
+// Which value the search tries first
+enum class BranchValue {
+  FILLED_FIRST,
+  EMPTY_FIRST,
+  LIKELIHOOD, // FILLED if the estimated fill likelihood is at least 1/2
+};
+
+struct SolverOptions {
+  PropagationOrder m_propagation_order{PropagationOrder::FIFO};
+  // Threads solving the lines of one orientation in parallel. With more than
+  // one thread, propagation alternates between batches of changed columns
+  // and changed rows, and the propagation order is ignored.
+  int m_threads{1};
+  // Threads exploring search branches; more than one selects the
+  // work-stealing search, in which each worker propagates on its own
+  int m_search_threads{1};
+  BranchCell m_branch_cell{BranchCell::FIRST};
+  BranchValue m_branch_value{BranchValue::FILLED_FIRST};
+  // Unknown cells probed with both values before each branching, 0 disables
+  // probing
+  int m_probe_budget{0};
+  // Lines kept in the line solve cache, 0 disables caching
+  size_t m_line_cache_capacity{0};
+  // Lines of at most this many cells, up to kPlacementTableCells, are solved
+  // from placement tables when theirs is small enough; 0 disables the tables
+  int m_placement_table_cells{0};
+  // Limits of one solve or count, 0 disables them
+  std::chrono::milliseconds m_time_limit{0};
+  long m_node_limit{0};
+  // Whether the serial search learns from conflicts: it traces each failed
+  // branch back to the decisions it follows from, records them as a nogood
+  // and backtracks straight to the latest of them
+  bool m_learning{false};
+};
+
+// Grows the calling thread's line solver buffers to fit every line of
+// puzzle, and its probe buffers to fit the grid if options probe
+void reserve_line_scratch(const Puzzle &puzzle,
+                          const SolverOptions &options = {});
+
+// The limits of options from the start of a search. They are checked
+// cooperatively before each search node, so a single propagation can
+// overrun them.
+struct SearchBudget {
+  explicit SearchBudget(const SolverOptions &options);
+
+  // Whether the search must stop after expanding nodes search nodes
+  bool exhausted(long nodes) const;
+
+  long m_node_limit;
+  std::optional<std::chrono::steady_clock::time_point> m_deadline;
+};
+
+struct SolverStats {
+  long m_line_solves{0};
+  // Line solves avoided because the line had not changed since it was last
+  // solved (sweep order), or because it was already queued (other orders)
+  long m_line_solves_skipped{0};
+  // Search states expanded, in total and per search thread
+  long m_search_nodes{0};
+  std::vector<long> m_thread_nodes;
+  // Single-value propagations run by probing, and cells they fixed
+  long m_probes{0};
+  long m_probe_fixed_cells{0};
+  // Calls of propagate
+  long m_propagation_rounds{0};
+  // update_cells calls, which exclude line cache hits
+  long m_row_updates{0};
+  long m_column_updates{0};
+  // States filled by the fitting DP
+  long m_dp_states{0};
+  // Left and right fits of long lines computed by the DP, and reused
+  long m_fits_computed{0};
+  long m_fits_reused{0};
+  // Cells fixed by line solves and by branching
+  long m_propagation_fixed_cells{0};
+  long m_search_fixed_cells{0};
+  // Deepest branch stack (serial search only) and branches abandoned
+  long m_max_depth{0};
+  long m_backtracks{0};
+  // Conflict learning: nogoods recorded, cells they fixed, and branch
+  // levels skipped by backjumps
+  long m_nogoods{0};
+  long m_nogood_fixed_cells{0};
+  long m_backjumped_levels{0};
+
+  // Bytes held by the placement tables at the end of the solve; adding up
+  // keeps the largest
+  size_t m_placement_table_bytes{0};
+
+  // Whether propagate measures its time, in m_propagate_ns
+  bool m_time_phases{false};
+  long m_propagate_ns{0};
+
+  // Adds up the counters of another thread, except per-thread ones
+  SolverStats &operator+=(const SolverStats &other);
+};
+
+struct ThreadPool;
+struct LineCache;
+struct Nogoods;
+
+// Shared resources used while solving, all optional
+struct SolverContext {
+  // solves the lines of one orientation in parallel
+  ThreadPool *m_pool{nullptr};
+  // memoizes line solves
+  LineCache *m_cache{nullptr};
+  // placement table of each line, or nullptr to solve it as usual; empty if
+  // no line has one
+  std::span<const PlacementTable *const> m_line_tables;
+  // learned by the search, and propagated along with the lines
+  Nogoods *m_nogoods{nullptr};
+};
 
+// Solves changed lines until none is left. Returns false if some line cannot
+// fit its rules.
+bool propagate(const Puzzle &puzzle, Solution &solution, SolverStats &stats,
+               const SolverContext &context = {});
+bool propagate(const Puzzle &puzzle, Solution &solution);
+
+std::optional<std::pair<int, int>> find_unknown_cell(const Solution &solution);
+
+// Estimated probability that cell (i, j) is FILLED, averaging over its row
+// and column the chance that a uniformly placed block covers it
+double fill_likelihood(const Solution &solution, int i, int j);
+
+struct BranchDecision {
+  int m_i;
+  int m_j;
+  // values in the order they are tried
+  std::array<Cell, 2> m_values;
+};
+
+// Picks the next branch according to the options, or nullopt if the
+// solution has no unknown cells left
+std::optional<BranchDecision> choose_branch(const Solution &solution,
+                                            const SolverOptions &options);
+
+// Cells fixed by propagating one probe value
+struct ProbeOutcome {
+  bool m_rules_fit;
+  // cells with their values
+  std::vector<std::tuple<int, int, Cell>> m_cells;
+};
+
+// Per-thread buffers of probe, kept with the line solver's, so that probing
+// does not touch the heap once they have grown
+struct ProbeScratch {
+  ProbeOutcome m_filled;
+  ProbeOutcome m_empty;
+  // value implied by the FILLED probe, per cell; UNKNOWN between probes
+  std::vector<Cell> m_filled_values;
+};
+
+// The calling thread's probe buffers
+ProbeScratch &probe_scratch();
+
+// Failed-literal probing: sets unknown cells to FILLED and to EMPTY in turn
+// and propagates each. If one value contradicts, the other is fixed; cells
+// both values agree on are fixed as well. The solution must be recording,
+// and at a propagation fixpoint. Returns false if some cell contradicts with
+// both values.
+bool probe(const Puzzle &puzzle, Solution &solution,
+           const SolverOptions &options, SolverStats &stats,
+           const SolverContext &context = {});
+
+// Depth-first search from root, spread over m_search_threads work-stealing
+// workers. All workers stop as soon as one of them finds a final solution.
+// Workers share the cache and tables of context, but not its pool.
+Solution search_parallel(const Puzzle &puzzle, const Solution &root,
+                         const SolverOptions &options, SolverStats &stats,
+                         const SolverContext &context);
+
+// Uses cache for line solves if given, otherwise a cache of
+// m_line_cache_capacity lines private to this call, if that is not 0. The
+// same goes for tables, used if m_placement_table_cells is not 0, and for
+// pool, which solves lines in parallel if m_threads is above 1.
+Solution solve_puzzle(const Puzzle &puzzle, const SolverOptions &options,
+                      SolverStats &stats, LineCache *cache = nullptr,
+                      PlacementTables *tables = nullptr,
+                      ThreadPool *pool = nullptr);
 Solution solve_puzzle(const Puzzle &puzzle);
+
+struct CountResult {
+  // solutions found, at most the limit
+  long m_count{0};
+  // whether the time or node limit stopped the count, which is then a lower
+  // bound
+  bool m_timed_out{false};
+  // the first two solutions found, which differ in some cell
+  std::vector<Solution> m_witnesses;
+};
+
+// Enumerates solutions until limit of them are found: 1 finds one, 2 checks
+// uniqueness. Searches serially, ignoring m_search_threads.
+CountResult count_solutions(const Puzzle &puzzle, long limit,
+                            const SolverOptions &options, SolverStats &stats,
+                            LineCache *cache = nullptr,
+                            PlacementTables *tables = nullptr);
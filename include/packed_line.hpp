@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+enum class Cell { UNKNOWN, FILLED, EMPTY };
+
+// Line of cells stored as two bit planes: bit i of m_filled is set iff cell i
+// is FILLED, bit i of m_empty is set iff cell i is EMPTY. UNKNOWN cells have
+// neither bit set.
+struct PackedLine {
+  using Word = std::uint64_t;
+  static constexpr int kWordBits = 64;
+
+  PackedLine() = default;
+  explicit PackedLine(int size);
+
+  // Packs cells[0..size) in forward order
+  void assign(const Cell *cells, int size);
+  // Packs cells[0..size) in reverse order, so that bit i holds cells[size-1-i]
+  void assign_reversed(const Cell *cells, int size);
+  // Copies already packed words, as many as size cells take
+  void assign_words(const Word *filled, const Word *empty, int size);
+  // Copies line in reverse order
+  void assign_reversed(const PackedLine &line);
+
+  int size() const { return m_size; }
+  Cell get(int i) const;
+  void set(int i, Cell value);
+
+  bool is_filled(int i) const {
+    return (m_filled[i / kWordBits] >> (i % kWordBits)) & 1;
+  }
+  bool is_empty(int i) const {
+    return (m_empty[i / kWordBits] >> (i % kWordBits)) & 1;
+  }
+
+  // Whether any cell in [begin, end) is FILLED
+  bool has_filled(int begin, int end) const;
+  // Whether any cell in [begin, end) is EMPTY
+  bool has_empty(int begin, int end) const;
+
+  int m_size{0};
+  std::vector<Word> m_filled;
+  std::vector<Word> m_empty;
+};
+
+// Bit i of the result is bit 63 - i of word
+PackedLine::Word reverse_bits(PackedLine::Word word);
+
+// Prefix popcounts over a PackedLine, answering range queries in O(1). The
+// index is a snapshot: it must be rebuilt after the line changes.
+struct PackedLineIndex {
+  PackedLineIndex() = default;
+  explicit PackedLineIndex(const PackedLine &line) { build(line); }
+
+  void build(const PackedLine &line);
+
+  // Number of FILLED cells in [begin, end)
+  int count_filled(int begin, int end) const;
+  // Number of EMPTY cells in [begin, end)
+  int count_empty(int begin, int end) const;
+
+  bool has_filled(int begin, int end) const {
+    return begin < end && count_filled(begin, end) > 0;
+  }
+  bool has_empty(int begin, int end) const {
+    return begin < end && count_empty(begin, end) > 0;
+  }
+  bool is_filled(int i) const { return m_line->is_filled(i); }
+  int size() const { return m_line->size(); }
+
+  const PackedLine *m_line{nullptr};
+  // m_*_rank[w] is the number of set bits in words [0, w)
+  std::vector<int> m_filled_rank;
+  std::vector<int> m_empty_rank;
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "nonogram.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Lines of at most this many cells can be solved from a placement table
+constexpr int kPlacementTableCells = 32;
+// Tables with more placements are not built, and their lines are solved as
+// usual
+constexpr long kMaxTablePlacements = 64;
+
+// Every placement of the blocks of some rules on a line, in lexicographic
+// order of their starts. The leftmost fit of a line is the first placement
+// consistent with its cells and the rightmost fit the last one, so both
+// come out of the same scan as the cells.
+struct PlacementTable {
+  PlacementTable(const RulesLine &rules, int size);
+
+  // Same as update_cells, from the placements consistent with cells. Unlike
+  // the fitting DP, it fixes every cell all those placements agree on.
+  void update(const PackedLine &cells, UpdateResult &result) const;
+
+  size_t memory_bytes() const;
+
+  int m_size;
+  int m_n_rules;
+  // Bit s of a mask is set if the placement fills cell s
+  std::vector<std::uint32_t> m_masks;
+  // Rule r of placement p starts at m_starts[p * m_n_rules + r]
+  std::vector<std::uint8_t> m_starts;
+};
+
+// Number of placements of rules on a line of size cells, or more than limit
+// if there are more than that
+long count_placements(const RulesLine &rules, int size, long limit);
+
+// Placement tables built on first use, keyed by line size and rules, and
+// shared by every thread solving with them
+struct PlacementTables {
+  explicit PlacementTables(int max_cells = kPlacementTableCells);
+
+  // The table of rules on a line of size cells, or nullptr if the line is
+  // longer than m_max_cells or has too many placements
+  const PlacementTable *get(const RulesLine &rules, int size);
+
+  // Tables built, and bytes held by them and their keys
+  size_t size() const;
+  size_t memory_bytes() const;
+
+  int m_max_cells;
+  mutable std::shared_mutex m_mutex;
+  // a null table marks rules with too many placements
+  std::unordered_map<std::string, std::unique_ptr<PlacementTable>> m_tables;
+  std::atomic<size_t> m_bytes{0};
+};
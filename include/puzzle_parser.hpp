@@ -0,0 +1,66 @@
+#pragma once
+
+#include "nonogram.hpp"
+
+#include <cstddef>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// Malformed puzzle input
+struct ParseError : std::runtime_error {
+  ParseError(int line, const std::string &message);
+
+  // 1-based line of the input the error was found on
+  int m_line;
+};
+
+// Sides of a "width height" header line, or nullopt if line is blank. Throws
+// ParseError if the header is malformed or a side is out of range.
+std::optional<std::pair<int, int>> parse_header(std::string_view line,
+                                                int line_no);
+
+// Parses one line of rules for a line of line_size cells into rule. Throws
+// ParseError on junk tokens, non-positive rules or rules that do not fit.
+void parse_rules_line(std::string_view line, int line_no, int line_size,
+                      RulesLine &rule);
+
+// Parses concatenated puzzles straight out of a buffer in the test_data
+// format: a "width height" header, then one line of rules per column and one
+// per row. Blank lines before a header are skipped. Only the rules of the
+// parsed puzzles are allocated.
+struct PuzzleParser {
+  explicit PuzzleParser(std::string_view data) : m_data(data) {}
+
+  // Next puzzle, or nullopt at the end of input. Throws ParseError.
+  std::optional<Puzzle> next();
+
+  std::string_view m_data;
+  size_t m_pos{0};
+  // 1-based line of m_pos
+  int m_line{1};
+
+private:
+  std::string_view next_line();
+  void read_rules(std::vector<RulesLine> &rules, int line_size);
+};
+
+// Whole file mapped read-only into memory. Files that cannot be mapped, like
+// pipes, are read into a buffer instead.
+struct MappedFile {
+  // Throws std::system_error if the file cannot be mapped
+  explicit MappedFile(const std::string &path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  std::string_view data() const { return {m_data, m_size}; }
+
+  const char *m_data{nullptr};
+  size_t m_size{0};
+  bool m_mapped{false};
+  std::string m_buffer;
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "line_cache.hpp"
+#include "nonogram.hpp"
+#include "placement_table.hpp"
+#include "thread_pool.hpp"
+
+#include <atomic>
+#include <optional>
+#include <string>
+
+struct ServerOptions {
+  SolverOptions m_solver;
+  // puzzles solved at the same time, across all connections
+  int m_jobs{1};
+  // requests of one connection read ahead of their answers
+  int m_max_in_flight{64};
+  // Longer requests and larger puzzles are answered with an error instead
+  // of being read into memory or solved
+  long m_max_request_bytes{16 << 20};
+  long m_max_cells{1 << 22};
+  // Longer header lines are answered like malformed ones
+  long m_max_header_bytes{4 << 10};
+};
+
+// Answers puzzles sent over byte streams. The solver threads, their line
+// solver buffers, the line cache and the placement tables stay warm from one
+// request to the next.
+//
+// A request is a header line "solve <id> <length>" followed by length bytes
+// holding one puzzle in the text format. Its answer is a header line
+// "<id> <status> <queue_ns> <solve_ns> <length>" followed by length bytes:
+// the grid reached, or the reason for an "error" status. Status is solved,
+// unsolvable, timed_out or error. Requests may be sent before the earlier
+// ones are answered, and answers are written as puzzles are solved, not in
+// request order. A malformed or over-long header is answered with id "-" and
+// ends the connection.
+struct SolverServer {
+  explicit SolverServer(const ServerOptions &options);
+
+  // Answers the requests read from in_fd on out_fd until in_fd ends or sends
+  // a malformed header. Returns once every answer is written.
+  void serve(int in_fd, int out_fd);
+
+  // Serves every connection to a Unix socket bound at path on a thread of
+  // its own until stop is set, then closes them. Throws std::system_error if
+  // the socket cannot be set up.
+  void serve_socket(const std::string &path, const std::atomic<bool> &stop);
+
+  ServerOptions m_options;
+  std::optional<LineCache> m_cache;
+  std::optional<PlacementTables> m_tables;
+  // runs the requests
+  ThreadPool m_pool;
+  // solves the lines of every request in parallel if m_solver.m_threads is
+  // above 1, as solve_puzzle would
+  std::optional<ThreadPool> m_line_pool;
+  // requests answered, over all connections
+  std::atomic<long> m_requests{0};
+};
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "nonogram.hpp"
+
+// Lines of at most this many cells fit in one word, and are solved with bit
+// arithmetic on masks instead of the fitting DP
+constexpr int kShortLineCells = PackedLine::kWordBits;
+
+// Same as update_cells for a line of at most kShortLineCells cells. Bit s of
+// the masks it works on stands for cell s, or for a block starting at cell
+// s, so that each rule is fitted to every position at once.
+void update_short_line(const RulesLine &rules, const PackedLine &cells,
+                       UpdateResult &result);
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <semaphore>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running submitted tasks in FIFO order
+struct ThreadPool {
+  explicit ThreadPool(int n_threads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  int size() const { return m_workers.size(); }
+
+  void submit(std::function<void()> task);
+
+  // Runs fn(k) for every k in [0, n) on the workers and the calling thread,
+  // returning once all calls have finished
+  void parallel_for(int n, const std::function<void(int)> &fn);
+
+  std::vector<std::thread> m_workers;
+  std::deque<std::function<void()>> m_tasks;
+  std::mutex m_mutex;
+  // one release per queued task, plus one per worker on shutdown
+  std::counting_semaphore<> m_available{0};
+  bool m_stopping{false};
+
+private:
+  void worker_loop();
+};
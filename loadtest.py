@@ -0,0 +1,138 @@
+"""Load test for `nonogram --serve PATH`.
+
+Sends the puzzles of a file to the server over a few connections, keeping
+several requests in flight on each, and reports the latency percentiles
+seen by the client along with the queue and solve times the server reports.
+"""
+
+import argparse
+import socket
+import threading
+import time
+from itertools import cycle
+from pathlib import Path
+
+
+def read_puzzles(path):
+    """Splits concatenated text puzzles: a "width height" header, then one
+    line of rules per column and one per row."""
+    lines = Path(path).read_text().splitlines(keepends=True)
+    puzzles = []
+    i = 0
+    while i < len(lines):
+        if not lines[i].strip():
+            i += 1
+            continue
+        width, height = map(int, lines[i].split())
+        end = i + 1 + width + height
+        puzzles.append("".join(lines[i:end]).encode())
+        i = end
+    return puzzles
+
+
+class Reader:
+    """Buffered reads of answers from a socket."""
+
+    def __init__(self, sock):
+        self.sock = sock
+        self.buffer = b""
+
+    def fill(self):
+        chunk = self.sock.recv(1 << 16)
+        if not chunk:
+            raise ConnectionError("server closed the connection")
+        self.buffer += chunk
+
+    def line(self):
+        while b"\n" not in self.buffer:
+            self.fill()
+        line, self.buffer = self.buffer.split(b"\n", 1)
+        return line.decode()
+
+    def bytes(self, n):
+        while len(self.buffer) < n:
+            self.fill()
+        data, self.buffer = self.buffer[:n], self.buffer[n:]
+        return data
+
+
+def run_connection(path, requests, in_flight, results):
+    """Sends requests, a list of (id, puzzle), keeping up to in_flight of them
+    unanswered, and appends (latency_ns, status, queue_ns, solve_ns) to
+    results."""
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(path)
+    reader = Reader(sock)
+    sent_at = {}
+    next_request = 0
+    answered = 0
+    while answered < len(requests):
+        while next_request < len(requests) and len(sent_at) < in_flight:
+            request_id, puzzle = requests[next_request]
+            sent_at[request_id] = time.perf_counter_ns()
+            sock.sendall(b"solve %s %d\n" % (request_id.encode(), len(puzzle)) + puzzle)
+            next_request += 1
+        request_id, status, queue_ns, solve_ns, length = reader.line().split()
+        text = reader.bytes(int(length))
+        if request_id == "-":
+            # the server could not frame a request and closed the connection
+            raise RuntimeError(f"server rejected a request: {text.decode().strip()}")
+        latency_ns = time.perf_counter_ns() - sent_at.pop(request_id)
+        results.append((latency_ns, status, int(queue_ns), int(solve_ns)))
+        answered += 1
+    sock.close()
+
+
+def percentile(values, p):
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * p / 100))]
+
+
+def report(name, values_ns):
+    us = [v / 1e3 for v in values_ns]
+    print(
+        f"{name}: p50={percentile(us, 50):,.1f}us p90={percentile(us, 90):,.1f}us "
+        f"p99={percentile(us, 99):,.1f}us max={max(us):,.1f}us"
+    )
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("socket", help="socket path given to nonogram --serve")
+    parser.add_argument("puzzles", help="text file of concatenated puzzles")
+    parser.add_argument("-n", "--requests", type=int, default=1000)
+    parser.add_argument("-c", "--connections", type=int, default=1)
+    parser.add_argument(
+        "-p", "--pipeline", type=int, default=8, help="requests in flight per connection"
+    )
+    args = parser.parse_args()
+
+    puzzles = read_puzzles(args.puzzles)
+    requests = [(str(k), puzzle) for k, puzzle in zip(range(args.requests), cycle(puzzles))]
+    per_connection = [requests[c :: args.connections] for c in range(args.connections)]
+    results = []
+    threads = [
+        threading.Thread(target=run_connection, args=(args.socket, share, args.pipeline, results))
+        for share in per_connection
+    ]
+    begin = time.perf_counter()
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    wall = time.perf_counter() - begin
+
+    statuses = {}
+    for _, status, _, _ in results:
+        statuses[status] = statuses.get(status, 0) + 1
+    print(
+        f"{len(results)} requests in {wall:.3f}s, {len(results) / wall:,.0f} req/s, "
+        + ", ".join(f"{status} {count}" for status, count in sorted(statuses.items()))
+    )
+    report("latency", [r[0] for r in results])
+    report("server queue", [r[2] for r in results])
+    report("server solve", [r[3] for r in results])
+
+
+if __name__ == "__main__":
+    main()
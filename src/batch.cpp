@@ -0,0 +1,137 @@
+#include "batch.hpp"
+#include "placement_table.hpp"
+#include "thread_pool.hpp"
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <semaphore>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+long elapsed_ns(Clock::time_point begin) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                              begin)
+      .count();
+}
+
+// Hands results to the callback, reordering them if needed, and frees an
+// in-flight slot for every result handed out
+struct ResultSink {
+  ResultSink(bool ordered, const std::function<void(BatchResult &)> &on_result,
+             std::counting_semaphore<> &slots)
+      : m_ordered(ordered), m_on_result(on_result), m_slots(slots) {}
+
+  void push(BatchResult result) {
+    std::lock_guard lock(m_mutex);
+    m_solved += result.m_solved;
+    if (!m_ordered) {
+      emit(result);
+      return;
+    }
+    m_pending.emplace(result.m_index, std::move(result));
+    for (auto it = m_pending.begin();
+         it != m_pending.end() && it->first == m_next_index;
+         it = m_pending.erase(it), ++m_next_index) {
+      emit(it->second);
+    }
+  }
+
+  void emit(BatchResult &result) {
+    m_on_result(result);
+    m_slots.release();
+  }
+
+  bool m_ordered;
+  const std::function<void(BatchResult &)> &m_on_result;
+  std::counting_semaphore<> &m_slots;
+  std::mutex m_mutex;
+  // finished results waiting for an earlier one, by index
+  std::map<int, BatchResult> m_pending;
+  int m_next_index{0};
+  int m_solved{0};
+};
+
+} // namespace
+
+BatchSummary solve_batch(const PuzzleSource &next_puzzle,
+                         const BatchOptions &options,
+                         const std::function<void(BatchResult &)> &on_result,
+                         LineCache *cache) {
+  auto begin = Clock::now();
+  int jobs = std::max(1, options.m_jobs);
+  // bounds the puzzles parsed ahead plus the results held back for ordering
+  int max_in_flight = 2 * jobs;
+  std::counting_semaphore<> slots(max_in_flight);
+  ResultSink sink(options.m_ordered, on_result, slots);
+  // the same short lines come up in many puzzles
+  std::optional<PlacementTables> tables;
+  if (options.m_solver.m_placement_table_cells > 0) {
+    tables.emplace(options.m_solver.m_placement_table_cells);
+  }
+  auto *tables_ptr = tables ? &tables.value() : nullptr;
+
+  int index = 0;
+  {
+    ThreadPool pool(jobs);
+    while (true) {
+      slots.acquire();
+      auto puzzle = next_puzzle();
+      if (!puzzle.has_value()) {
+        slots.release();
+        break;
+      }
+      pool.submit([&, index, puzzle = std::move(*puzzle)] {
+        SolverStats stats;
+        stats.m_time_phases = options.m_time_phases;
+        auto solve_begin = Clock::now();
+        BatchResult result{.m_index = index};
+        if (options.m_solution_limit > 0) {
+          auto counted = count_solutions(puzzle, options.m_solution_limit,
+                                         options.m_solver, stats, cache,
+                                         tables_ptr);
+          result.m_solved = counted.m_count > 0;
+          result.m_status = counted.m_timed_out ? SolveStatus::TIMED_OUT
+                            : result.m_solved   ? SolveStatus::SOLVED
+                                                : SolveStatus::UNSOLVABLE;
+          result.m_solution_count = counted.m_count;
+          if (!counted.m_witnesses.empty()) {
+            result.m_solution = std::move(counted.m_witnesses.front());
+          } else {
+            result.m_solution.emplace(puzzle.m_width, puzzle.m_height,
+                                      puzzle.m_vertical_rules,
+                                      puzzle.m_horizontal_rules);
+          }
+        } else {
+          result.m_solution =
+              solve_puzzle(puzzle, options.m_solver, stats, cache, tables_ptr);
+          result.m_solved = result.m_solution->m_is_final;
+          result.m_status = result.m_solution->m_status;
+          result.m_solution_count = result.m_solved;
+        }
+        result.m_solve_ns = elapsed_ns(solve_begin);
+        result.m_stats = std::move(stats);
+        sink.push(std::move(result));
+      });
+      ++index;
+    }
+    // every slot comes back once all results are handed out
+    for (int k = 0; k < max_in_flight; ++k) {
+      slots.acquire();
+    }
+  }
+
+  return {.m_puzzles = index,
+          .m_solved = sink.m_solved,
+          .m_wall_ns = elapsed_ns(begin)};
+}
+
+BatchSummary solve_batch(std::istream &input, const BatchOptions &options,
+                         const std::function<void(BatchResult &)> &on_result,
+                         LineCache *cache) {
+  int line_no = 1;
+  return solve_batch([&] { return read_next_puzzle(input, &line_no); },
+                     options, on_result, cache);
+}
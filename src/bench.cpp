@@ -0,0 +1,189 @@
+#include "nonogram.hpp"
+#include "placement_table.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <random>
+
+namespace {
+
+// Line of the given length with `clues` blocks at random positions, of which
+// roughly a third of the cells are known
+struct RandomLine {
+  RandomLine(int length, int clues) {
+    std::mt19937 rng(length * 31 + clues);
+    // every block and every inner gap has one cell, the rest is spread
+    // randomly over blocks and gaps
+    int free = length - 2 * clues + 1;
+    std::vector<int> extra(2 * clues + 1, 0);
+    for (int k = 0; k < free; ++k) {
+      ++extra[rng() % extra.size()];
+    }
+    CellsLine cells;
+    for (int r = 0; r < clues; ++r) {
+      cells.insert(cells.end(), extra[2 * r] + (r > 0), Cell::EMPTY);
+      m_rules.push_back(1 + extra[2 * r + 1]);
+      cells.insert(cells.end(), m_rules.back(), Cell::FILLED);
+    }
+    cells.resize(length, Cell::EMPTY);
+    m_line = SolutionLine(length, m_rules);
+    for (int i = 0; i < length; ++i) {
+      m_line.m_cells[i] = rng() % 3 == 0 ? cells[i] : Cell::UNKNOWN;
+    }
+  }
+
+  RulesLine m_rules;
+  SolutionLine m_line{0, RulesLine{}};
+};
+
+// Line lengths crossed with one clue, a few clues and as many as fit
+void line_args(benchmark::internal::Benchmark *bench) {
+  for (int length : {16, 64, 256, 1024, 4096}) {
+    bench->Args({length, 1});
+    if (length / 16 > 1) {
+      bench->Args({length, length / 16});
+    }
+    bench->Args({length, length / 3});
+  }
+}
+
+// Runs of each benchmark, enough for p90 to lie below the largest
+constexpr int kRepetitions = 10;
+
+// Percentile p of values, interpolated between the two samples around it
+double percentile(const std::vector<double> &values, double p) {
+  auto sorted = values;
+  std::sort(sorted.begin(), sorted.end());
+  double rank = p * (sorted.size() - 1);
+  size_t below = rank;
+  size_t above = std::min(below + 1, sorted.size() - 1);
+  return sorted[below] + (rank - below) * (sorted[above] - sorted[below]);
+}
+
+// Warms up, then reports percentiles over repeated runs. Only those the
+// repetitions can tell from the maximum are reported; p99 would need 100.
+benchmark::internal::Benchmark *
+with_statistics(benchmark::internal::Benchmark *bench) {
+  return bench->MinWarmUpTime(0.05)
+      ->Repetitions(kRepetitions)
+      ->DisplayAggregatesOnly(true)
+      ->ComputeStatistics(
+          "p50", [](const std::vector<double> &v) { return percentile(v, 0.5); })
+      ->ComputeStatistics("p90", [](const std::vector<double> &v) {
+        return percentile(v, 0.9);
+      });
+}
+
+void BM_FitLeft(benchmark::State &state) {
+  RandomLine line(state.range(0), state.range(1));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(fit_left(line.m_rules, line.m_line));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_FitRight(benchmark::State &state) {
+  RandomLine line(state.range(0), state.range(1));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(fit_right(line.m_rules, line.m_line));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_UpdateCells(benchmark::State &state) {
+  RandomLine line(state.range(0), state.range(1));
+  UpdateResult result;
+  for (auto _ : state) {
+    update_cells(line.m_rules, line.m_line, result);
+    benchmark::DoNotOptimize(result);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Lines with too many placements for a table solve as in update_cells
+void BM_UpdateCellsFromTable(benchmark::State &state) {
+  RandomLine line(state.range(0), state.range(1));
+  PlacementTables tables;
+  auto table = tables.get(line.m_rules, line.m_line.size());
+  UpdateResult result;
+  for (auto _ : state) {
+    update_cells(line.m_rules, line.m_line, result, table);
+    benchmark::DoNotOptimize(result);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.counters["placements"] =
+      count_placements(line.m_rules, line.m_line.size(), kMaxTablePlacements);
+}
+
+void BM_SolvePuzzle(benchmark::State &state, const Puzzle &puzzle) {
+  for (auto _ : state) {
+    SolverStats stats;
+    benchmark::DoNotOptimize(solve_puzzle(puzzle, {}, stats));
+  }
+}
+
+void register_line_benchmark(const char *name,
+                             void (*fn)(benchmark::State &)) {
+  with_statistics(benchmark::RegisterBenchmark(name, fn))
+      ->Apply(line_args)
+      ->ArgNames({"length", "clues"});
+}
+
+// Lines short enough for placement tables
+void register_short_line_benchmark(const char *name,
+                                   void (*fn)(benchmark::State &)) {
+  with_statistics(benchmark::RegisterBenchmark(name, fn))
+      ->ArgsProduct({{12, 24}, {1, 3, 6}})
+      ->ArgNames({"length", "clues"});
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  benchmark::Initialize(&argc, argv);
+
+  register_line_benchmark("fit_left", BM_FitLeft);
+  register_line_benchmark("fit_right", BM_FitRight);
+  register_line_benchmark("update_cells", BM_UpdateCells);
+  register_short_line_benchmark("update_cells/short", BM_UpdateCells);
+  register_short_line_benchmark("update_cells/table", BM_UpdateCellsFromTable);
+
+  std::vector<std::filesystem::path> files;
+  for (const auto &entry :
+       std::filesystem::directory_iterator(NONOGRAM_TEST_DATA_DIR)) {
+    if (!entry.path().filename().string().starts_with("_")) {
+      files.push_back(entry.path());
+    }
+  }
+  std::sort(files.begin(), files.end());
+  // arguments left after the benchmark flags are extra puzzle files, e.g.
+  // from nonogram_generate
+  files.insert(files.end(), argv + 1, argv + argc);
+
+  std::deque<Puzzle> puzzles;
+  for (const auto &file : files) {
+    std::ifstream input(file);
+    if (!input) {
+      std::cerr << "cannot open " << file << std::endl;
+      return 1;
+    }
+    for (int k = 0; auto puzzle = read_next_puzzle(input); ++k) {
+      puzzles.push_back(std::move(puzzle.value()));
+      auto name = "solve_puzzle/" + file.stem().string();
+      if (k > 0) {
+        name += "#" + std::to_string(k);
+      }
+      auto *bench = benchmark::RegisterBenchmark(name.c_str(), BM_SolvePuzzle,
+                                                 std::cref(puzzles.back()));
+      with_statistics(bench)->Unit(benchmark::kMicrosecond);
+    }
+  }
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,274 @@
+#include "binary_format.hpp"
+
+#include <cassert>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+constexpr std::uint32_t kVersion = 1;
+constexpr size_t kHeaderSize = 8;
+constexpr size_t kTrailerSize = 16;
+
+const char *magic(BinaryKind kind) {
+  return kind == BinaryKind::PUZZLES ? "NGPZ" : "NGSL";
+}
+
+void put_u32(std::string &out, std::uint32_t value) {
+  for (int k = 0; k < 4; ++k) {
+    out.push_back(static_cast<char>(value >> (8 * k)));
+  }
+}
+
+void put_u64(std::string &out, std::uint64_t value) {
+  for (int k = 0; k < 8; ++k) {
+    out.push_back(static_cast<char>(value >> (8 * k)));
+  }
+}
+
+std::uint64_t get_u64(const char *data) {
+  std::uint64_t value = 0;
+  for (int k = 0; k < 8; ++k) {
+    value |= std::uint64_t{static_cast<unsigned char>(data[k])} << (8 * k);
+  }
+  return value;
+}
+
+void put_varint(std::string &out, std::uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+// Decodes values from one record, checking that it does not run past its end
+struct RecordDecoder {
+  std::uint64_t varint() {
+    std::uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      auto byte = static_cast<unsigned char>(byte_at());
+      value |= std::uint64_t{byte & 0x7fu} << shift;
+      if (byte < 0x80) {
+        return value;
+      }
+    }
+    throw BinaryFormatError("varint too long");
+  }
+
+  int positive_int() {
+    auto value = varint();
+    if (value == 0 || value > std::numeric_limits<int>::max()) {
+      throw BinaryFormatError("value out of range");
+    }
+    return value;
+  }
+
+  void expect_end() const {
+    if (m_pos != m_data.size()) {
+      throw BinaryFormatError("record has trailing bytes");
+    }
+  }
+
+  char byte_at() {
+    if (m_pos == m_data.size()) {
+      throw BinaryFormatError("record is truncated");
+    }
+    return m_data[m_pos++];
+  }
+
+  std::string_view m_data;
+  size_t m_pos{0};
+};
+
+// Reads the rules of lines of line_size cells, checking that they fit
+void read_rules(RecordDecoder &decoder, std::vector<RulesLine> &rules,
+                int line_size) {
+  for (auto &rule : rules) {
+    auto count = decoder.varint();
+    if (count > decoder.m_data.size()) {
+      throw BinaryFormatError("rule count out of range");
+    }
+    rule.resize(count);
+    std::int64_t cells = -1;
+    for (auto &value : rule) {
+      value = decoder.positive_int();
+      cells += value + std::int64_t{1};
+    }
+    if (cells > line_size) {
+      throw BinaryFormatError("rules need " + std::to_string(cells) +
+                              " cells, but the line has " +
+                              std::to_string(line_size));
+    }
+  }
+}
+
+} // namespace
+
+bool is_binary(std::string_view data, BinaryKind kind) {
+  return data.size() >= 4 && data.substr(0, 4) == magic(kind);
+}
+
+BinaryWriter::BinaryWriter(std::ostream &os, BinaryKind kind)
+    : m_os(os), m_kind(kind) {
+  m_record.append(magic(kind), 4);
+  put_u32(m_record, kVersion);
+  m_os.write(m_record.data(), m_record.size());
+  m_offset = m_record.size();
+  m_record.clear();
+}
+
+void BinaryWriter::write_record() {
+  m_offsets.push_back(m_offset);
+  m_os.write(m_record.data(), m_record.size());
+  m_offset += m_record.size();
+  m_record.clear();
+}
+
+void BinaryWriter::add(const Puzzle &puzzle) {
+  assert(m_kind == BinaryKind::PUZZLES);
+  put_varint(m_record, puzzle.m_width);
+  put_varint(m_record, puzzle.m_height);
+  for (const auto *rules :
+       {&puzzle.m_vertical_rules, &puzzle.m_horizontal_rules}) {
+    for (const auto &rule : *rules) {
+      put_varint(m_record, rule.size());
+      for (auto value : rule) {
+        put_varint(m_record, value);
+      }
+    }
+  }
+  write_record();
+}
+
+void BinaryWriter::add(const Solution &solution) {
+  assert(m_kind == BinaryKind::SOLUTIONS);
+  put_varint(m_record, solution.m_width);
+  put_varint(m_record, solution.m_height);
+  m_record.push_back(solution.m_is_final);
+  if (solution.m_is_final) {
+    auto begin = m_record.size();
+    m_record.resize(begin + (size_t{1} * solution.m_width * solution.m_height +
+                             7) / 8);
+    size_t bit = 0;
+    for (int i = 0; i < solution.m_height; ++i) {
+      for (int j = 0; j < solution.m_width; ++j) {
+        if (solution.get_cell(i, j) == Cell::FILLED) {
+          m_record[begin + bit / 8] |= static_cast<char>(1 << (bit % 8));
+        }
+        ++bit;
+      }
+    }
+  }
+  write_record();
+}
+
+void BinaryWriter::finish() {
+  auto index_offset = m_offset;
+  for (auto offset : m_offsets) {
+    put_u64(m_record, offset);
+  }
+  put_u64(m_record, m_offsets.size());
+  put_u64(m_record, index_offset);
+  m_os.write(m_record.data(), m_record.size());
+  m_record.clear();
+}
+
+BinaryReader::BinaryReader(std::string_view data, BinaryKind kind)
+    : m_data(data), m_kind(kind) {
+  if (!is_binary(data, kind)) {
+    throw BinaryFormatError(std::string("missing magic ") + magic(kind));
+  }
+  if (data.size() < kHeaderSize + kTrailerSize) {
+    throw BinaryFormatError("file is truncated");
+  }
+  std::uint32_t version = 0;
+  for (int k = 0; k < 4; ++k) {
+    version |= std::uint32_t{static_cast<unsigned char>(data[4 + k])}
+               << (8 * k);
+  }
+  if (version != kVersion) {
+    throw BinaryFormatError("unsupported version " + std::to_string(version));
+  }
+  auto trailer = data.data() + data.size() - kTrailerSize;
+  auto count = get_u64(trailer);
+  auto index_offset = get_u64(trailer + 8);
+  auto index_end = data.size() - kTrailerSize;
+  if (index_offset < kHeaderSize || index_offset > index_end ||
+      (index_end - index_offset) / 8 != count ||
+      (index_end - index_offset) % 8 != 0) {
+    throw BinaryFormatError("index does not match the file size");
+  }
+  m_count = count;
+  m_index = data.data() + index_offset;
+}
+
+std::string_view BinaryReader::record(size_t n) const {
+  assert(n < m_count);
+  std::uint64_t index_offset = m_index - m_data.data();
+  auto begin = get_u64(m_index + 8 * n);
+  auto end = n + 1 < m_count ? get_u64(m_index + 8 * (n + 1)) : index_offset;
+  if (begin < kHeaderSize || begin > end || end > index_offset) {
+    throw BinaryFormatError("record offset out of range");
+  }
+  return m_data.substr(begin, end - begin);
+}
+
+Puzzle BinaryReader::puzzle(size_t n) const {
+  assert(m_kind == BinaryKind::PUZZLES);
+  RecordDecoder decoder{.m_data = record(n)};
+  int width = decoder.positive_int();
+  int height = decoder.positive_int();
+  if (width > Puzzle::kMaxSide || height > Puzzle::kMaxSide) {
+    throw BinaryFormatError("puzzle sides are longer than " +
+                            std::to_string(Puzzle::kMaxSide));
+  }
+  // every line takes at least the byte of its rule count
+  if (width + height > decoder.m_data.size() - decoder.m_pos) {
+    throw BinaryFormatError("record is truncated");
+  }
+  Puzzle puzzle(width, height);
+  read_rules(decoder, puzzle.m_vertical_rules, height);
+  read_rules(decoder, puzzle.m_horizontal_rules, width);
+  decoder.expect_end();
+  return puzzle;
+}
+
+SolutionGrid BinaryReader::solution(size_t n) const {
+  assert(m_kind == BinaryKind::SOLUTIONS);
+  RecordDecoder decoder{.m_data = record(n)};
+  SolutionGrid grid;
+  grid.m_width = decoder.positive_int();
+  grid.m_height = decoder.positive_int();
+  grid.m_solved = decoder.byte_at() != 0;
+  if (!grid.m_solved) {
+    decoder.expect_end();
+    return grid;
+  }
+  auto bits = decoder.m_data.substr(decoder.m_pos);
+  auto bytes = (size_t{1} * grid.m_width * grid.m_height + 7) / 8;
+  if (bits.size() < bytes) {
+    throw BinaryFormatError("record is truncated");
+  }
+  if (bits.size() > bytes) {
+    throw BinaryFormatError("record has trailing bytes");
+  }
+  grid.m_rows.assign(grid.m_height, CellsLine(grid.m_width));
+  size_t bit = 0;
+  for (auto &row : grid.m_rows) {
+    for (auto &cell : row) {
+      cell = (bits[bit / 8] >> (bit % 8)) & 1 ? Cell::FILLED : Cell::EMPTY;
+      ++bit;
+    }
+  }
+  return grid;
+}
+
+void print_solution(std::ostream &os, const SolutionGrid &grid) {
+  for (const auto &row : grid.m_rows) {
+    for (auto v : row) {
+      os << print_cell(v) << print_cell(v);
+    }
+    os << std::endl;
+  }
+}
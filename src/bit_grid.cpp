@@ -0,0 +1,188 @@
+#include "bit_grid.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <ranges>
+#include <span>
+
+namespace {
+
+using Word = BitGrid::Word;
+constexpr int kBlockBits = BitGrid::kBlockBits;
+
+int words_for(int size) { return (size + kBlockBits - 1) / kBlockBits; }
+
+void write_bit(Word &filled, Word &empty, int bit, Cell value) {
+  auto mask = Word{1} << bit;
+  filled &= ~mask;
+  empty &= ~mask;
+  if (value == Cell::FILLED) {
+    filled |= mask;
+  } else if (value == Cell::EMPTY) {
+    empty |= mask;
+  }
+}
+
+Cell read_bit(Word filled, Word empty, int bit) {
+  if ((filled >> bit) & 1) {
+    return Cell::FILLED;
+  }
+  if ((empty >> bit) & 1) {
+    return Cell::EMPTY;
+  }
+  return Cell::UNKNOWN;
+}
+
+// Transposes the block of one plane from words [from + k * from_stride] to
+// words [to + k * to_stride], for the from_count and to_count lines the
+// grid has in the block
+void transpose_plane(const Word *from, int from_stride, int from_count,
+                     Word *to, int to_stride, int to_count) {
+  Word block[kBlockBits] = {};
+  for (int k = 0; k < from_count; ++k) {
+    block[k] = from[static_cast<size_t>(k) * from_stride];
+  }
+  transpose_block(block);
+  for (int k = 0; k < to_count; ++k) {
+    to[static_cast<size_t>(k) * to_stride] = block[k];
+  }
+}
+
+} // namespace
+
+void transpose_block(Word block[kBlockBits]) {
+  // swaps ever smaller off-diagonal sub-blocks: the upper half bits of
+  // words k with the lower half bits of words k + j
+  Word mask = 0x00000000FFFFFFFF;
+  for (int j = 32; j != 0; j >>= 1, mask ^= mask << j) {
+    for (int k = 0; k < kBlockBits; k = ((k | j) + 1) & ~j) {
+      Word t = ((block[k] >> j) ^ block[k | j]) & mask;
+      block[k] ^= t << j;
+      block[k | j] ^= t;
+    }
+  }
+}
+
+BitGrid::BitGrid(int width, int height)
+    : m_width(width), m_height(height), m_row_words(words_for(width)),
+      m_column_words(words_for(height)),
+      m_row_filled(static_cast<size_t>(height) * m_row_words, 0),
+      m_row_empty(m_row_filled.size(), 0),
+      m_column_filled(static_cast<size_t>(width) * m_column_words, 0),
+      m_column_empty(m_column_filled.size(), 0),
+      m_blocks(static_cast<size_t>(m_column_words) * m_row_words,
+               BlockState::FRESH) {}
+
+Cell BitGrid::get(int i, int j) const {
+  if (block(i, j) == BlockState::ROWS_STALE) {
+    auto w = static_cast<size_t>(j) * m_column_words + i / kBlockBits;
+    return read_bit(m_column_filled[w], m_column_empty[w], i % kBlockBits);
+  }
+  auto w = static_cast<size_t>(i) * m_row_words + j / kBlockBits;
+  return read_bit(m_row_filled[w], m_row_empty[w], j % kBlockBits);
+}
+
+void BitGrid::write_row_bits(int i, int j, Cell value) {
+  auto w = static_cast<size_t>(i) * m_row_words + j / kBlockBits;
+  write_bit(m_row_filled[w], m_row_empty[w], j % kBlockBits, value);
+}
+
+void BitGrid::write_column_bits(int i, int j, Cell value) {
+  auto w = static_cast<size_t>(j) * m_column_words + i / kBlockBits;
+  write_bit(m_column_filled[w], m_column_empty[w], i % kBlockBits, value);
+}
+
+void BitGrid::set(int i, int j, Cell value) {
+  auto state = block(i, j);
+  if (state != BlockState::ROWS_STALE) {
+    write_row_bits(i, j, value);
+  }
+  if (state != BlockState::COLUMNS_STALE) {
+    write_column_bits(i, j, value);
+  }
+}
+
+void BitGrid::set_in_row(int i, int j, Cell value) {
+  auto &state = block(i, j);
+  if (state == BlockState::ROWS_STALE) {
+    transpose_to_rows(i / kBlockBits, j / kBlockBits);
+  }
+  write_row_bits(i, j, value);
+  state = BlockState::COLUMNS_STALE;
+}
+
+void BitGrid::set_in_column(int i, int j, Cell value) {
+  auto &state = block(i, j);
+  if (state == BlockState::COLUMNS_STALE) {
+    transpose_to_columns(i / kBlockBits, j / kBlockBits);
+  }
+  write_column_bits(i, j, value);
+  state = BlockState::ROWS_STALE;
+}
+
+void BitGrid::sync_row(int i) {
+  const int bi = i / kBlockBits;
+  for (int bj = 0; bj < m_row_words; ++bj) {
+    if (m_blocks[bi * m_row_words + bj] == BlockState::ROWS_STALE) {
+      transpose_to_rows(bi, bj);
+    }
+  }
+}
+
+void BitGrid::sync_column(int j) {
+  const int bj = j / kBlockBits;
+  for (int bi = 0; bi < m_column_words; ++bi) {
+    if (m_blocks[bi * m_row_words + bj] == BlockState::COLUMNS_STALE) {
+      transpose_to_columns(bi, bj);
+    }
+  }
+}
+
+void BitGrid::load_row(int i, PackedLine &line) const {
+  assert(std::ranges::none_of(
+      std::span(m_blocks).subspan((i / kBlockBits) * m_row_words, m_row_words),
+      [](auto state) { return state == BlockState::ROWS_STALE; }));
+  auto begin = static_cast<size_t>(i) * m_row_words;
+  line.assign_words(&m_row_filled[begin], &m_row_empty[begin], m_width);
+}
+
+void BitGrid::load_column(int j, PackedLine &line) const {
+  assert(std::ranges::none_of(
+      std::views::iota(0, m_column_words), [&](int bi) {
+        return m_blocks[bi * m_row_words + j / kBlockBits] ==
+               BlockState::COLUMNS_STALE;
+      }));
+  auto begin = static_cast<size_t>(j) * m_column_words;
+  line.assign_words(&m_column_filled[begin], &m_column_empty[begin], m_height);
+}
+
+size_t BitGrid::memory_bytes() const {
+  return (m_row_filled.size() + m_row_empty.size() + m_column_filled.size() +
+          m_column_empty.size()) *
+             sizeof(Word) +
+         m_blocks.size() * sizeof(BlockState);
+}
+
+void BitGrid::transpose_to_rows(int bi, int bj) {
+  int rows = std::min(kBlockBits, m_height - bi * kBlockBits);
+  int columns = std::min(kBlockBits, m_width - bj * kBlockBits);
+  auto from = static_cast<size_t>(bj) * kBlockBits * m_column_words + bi;
+  auto to = static_cast<size_t>(bi) * kBlockBits * m_row_words + bj;
+  transpose_plane(&m_column_filled[from], m_column_words, columns,
+                  &m_row_filled[to], m_row_words, rows);
+  transpose_plane(&m_column_empty[from], m_column_words, columns,
+                  &m_row_empty[to], m_row_words, rows);
+  m_blocks[bi * m_row_words + bj] = BlockState::FRESH;
+}
+
+void BitGrid::transpose_to_columns(int bi, int bj) {
+  int rows = std::min(kBlockBits, m_height - bi * kBlockBits);
+  int columns = std::min(kBlockBits, m_width - bj * kBlockBits);
+  auto from = static_cast<size_t>(bi) * kBlockBits * m_row_words + bj;
+  auto to = static_cast<size_t>(bj) * kBlockBits * m_column_words + bi;
+  transpose_plane(&m_row_filled[from], m_row_words, rows,
+                  &m_column_filled[to], m_column_words, columns);
+  transpose_plane(&m_row_empty[from], m_row_words, rows, &m_column_empty[to],
+                  m_column_words, columns);
+  m_blocks[bi * m_row_words + bj] = BlockState::FRESH;
+}
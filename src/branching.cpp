@@ -0,0 +1,176 @@
+#include "nonogram.hpp"
+
+#include <algorithm>
+
+namespace {
+
+// Probability that a uniformly placed block of rule r in its [lfit, rfit]
+// window covers cell k
+double block_cover_probability(const LineState &line, int r, int k) {
+  int lfit = line.m_lfit[r];
+  int rfit = line.m_rfit[r];
+  int rule = line.m_rules[r];
+  int covering = std::min(k, rfit) - std::max(lfit, k - rule + 1) + 1;
+  if (covering <= 0) {
+    return 0;
+  }
+  return static_cast<double>(covering) / (rfit - lfit + 1);
+}
+
+double line_fill_likelihood(const LineState &line, int k) {
+  double p = 0;
+  for (int r = 0; r < line.m_rules.size(); ++r) {
+    p += block_cover_probability(line, r, k);
+  }
+  return std::min(p, 1.0);
+}
+
+int line_slack(const LineState &line) {
+  int slack = 0;
+  for (int r = 0; r < line.m_rules.size(); ++r) {
+    slack += line.m_rfit[r] - line.m_lfit[r];
+  }
+  return slack;
+}
+
+// Position of the first unknown cell of a line, or -1 if there is none
+int first_unknown_in_line(const Solution &solution, int line) {
+  for (int k = 0; k < solution.get_line(line).size(); ++k) {
+    auto cell = line < solution.m_height
+                    ? solution.get_cell(line, k)
+                    : solution.get_cell(k, line - solution.m_height);
+    if (cell == Cell::UNKNOWN) {
+      return k;
+    }
+  }
+  return -1;
+}
+
+std::optional<std::pair<int, int>>
+find_most_constrained_cell(const Solution &solution) {
+  std::optional<int> best_line;
+  int best_slack = 0;
+  for (int line = 0; line < solution.m_height + solution.m_width; ++line) {
+    const auto &solution_line = solution.get_line(line);
+    if (solution_line.m_solved_flg ||
+        first_unknown_in_line(solution, line) < 0) {
+      continue;
+    }
+    auto slack = line_slack(solution_line);
+    if (!best_line.has_value() || slack < best_slack) {
+      best_line = line;
+      best_slack = slack;
+    }
+  }
+  if (!best_line.has_value()) {
+    return std::nullopt;
+  }
+
+  int k = first_unknown_in_line(solution, *best_line);
+  if (*best_line < solution.m_height) {
+    return std::make_pair(*best_line, k);
+  }
+  return std::make_pair(k, *best_line - solution.m_height);
+}
+
+// Adds to counts[k] the number of blocks of the line whose window covers k
+void add_candidate_blocks(const LineState &line, std::vector<int> &counts) {
+  std::fill(counts.begin(), counts.end(), 0);
+  std::vector<int> delta(line.size() + 1, 0);
+  for (int r = 0; r < line.m_rules.size(); ++r) {
+    ++delta[line.m_lfit[r]];
+    --delta[line.m_rfit[r] + line.m_rules[r]];
+  }
+  int covering = 0;
+  for (int k = 0; k < line.size(); ++k) {
+    covering += delta[k];
+    counts[k] = covering;
+  }
+}
+
+std::optional<std::pair<int, int>>
+find_most_covered_cell(const Solution &solution) {
+  std::vector<std::vector<int>> column_counts(solution.m_width,
+                                              std::vector<int>(solution.m_height));
+  for (int j = 0; j < solution.m_width; ++j) {
+    add_candidate_blocks(solution.get_column(j), column_counts[j]);
+  }
+
+  std::optional<std::pair<int, int>> best_cell;
+  int best_count = -1;
+  std::vector<int> row_counts(solution.m_width);
+  for (int i = 0; i < solution.m_height; ++i) {
+    if (solution.is_row_solved(i)) {
+      continue;
+    }
+    add_candidate_blocks(solution.get_row(i), row_counts);
+    for (int j = 0; j < solution.m_width; ++j) {
+      if (solution.get_cell(i, j) != Cell::UNKNOWN) {
+        continue;
+      }
+      auto count = row_counts[j] + column_counts[j][i];
+      if (count > best_count) {
+        best_cell = std::make_pair(i, j);
+        best_count = count;
+      }
+    }
+  }
+  return best_cell;
+}
+
+} // namespace
+
+std::optional<std::pair<int, int>> find_unknown_cell(const Solution &solution) {
+  for (int i = 0; i < solution.m_height; ++i) {
+    for (int j = 0; j < solution.m_width; ++j) {
+      if (solution.get_cell(i, j) == Cell::UNKNOWN) {
+        return std::make_pair(i, j);
+      }
+    }
+  }
+  return std::nullopt;
+}
+
+double fill_likelihood(const Solution &solution, int i, int j) {
+  return (line_fill_likelihood(solution.get_row(i), j) +
+          line_fill_likelihood(solution.get_column(j), i)) /
+         2;
+}
+
+std::optional<BranchDecision> choose_branch(const Solution &solution,
+                                            const SolverOptions &options) {
+  std::optional<std::pair<int, int>> cell;
+  switch (options.m_branch_cell) {
+  case BranchCell::FIRST:
+    cell = find_unknown_cell(solution);
+    break;
+  case BranchCell::MOST_CONSTRAINED_LINE:
+    cell = find_most_constrained_cell(solution);
+    break;
+  case BranchCell::MOST_CANDIDATE_BLOCKS:
+    cell = find_most_covered_cell(solution);
+    break;
+  }
+  if (!cell.has_value()) {
+    return std::nullopt;
+  }
+
+  auto [i, j] = cell.value();
+  BranchDecision decision{.m_i = i, .m_j = j};
+  switch (options.m_branch_value) {
+  case BranchValue::FILLED_FIRST:
+    decision.m_values = {Cell::FILLED, Cell::EMPTY};
+    break;
+  case BranchValue::EMPTY_FIRST:
+    decision.m_values = {Cell::EMPTY, Cell::FILLED};
+    break;
+  case BranchValue::LIKELIHOOD:
+    if (fill_likelihood(solution, i, j) >= 0.5) {
+      decision.m_values = {Cell::FILLED, Cell::EMPTY};
+    } else {
+      decision.m_values = {Cell::EMPTY, Cell::FILLED};
+    }
+    break;
+  }
+  return decision;
+}
@@ -0,0 +1,178 @@
+#include "binary_format.hpp"
+#include "generator.hpp"
+#include "nonogram.hpp"
+
+#include <boost/program_options.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+
+namespace po = boost::program_options;
+
+struct Options {
+  GeneratorOptions generator;
+  int puzzles;
+  std::uint64_t seed;
+  bool unique;
+  bool line_solvable;
+  long unique_node_limit;
+  int max_attempts;
+  bool binary;
+  std::string output_file;
+};
+
+Options parse_options(int argc, char **argv) {
+  po::variables_map vm;
+  try {
+    po::options_description desc("Allowed options");
+    desc.add_options()("help,h", po::bool_switch()->default_value(false),
+                       "produce help message")(
+        "width,W", po::value<int>()->default_value(10), "puzzle width")(
+        "height,H", po::value<int>()->default_value(10), "puzzle height")(
+        "density,d", po::value<double>()->default_value(0.5),
+        "probability of a cell being filled")(
+        "puzzles,n", po::value<int>()->default_value(1),
+        "number of puzzles to generate")(
+        "seed,s", po::value<std::uint64_t>()->default_value(1),
+        "random seed, the same seed gives the same puzzles")(
+        "unique,u", po::bool_switch()->default_value(false),
+        "keep only puzzles with exactly one solution; the check searches, so "
+        "it can be slow for large sparse grids")(
+        "line-solvable", po::bool_switch()->default_value(false),
+        "keep only puzzles solved by line propagation alone, which are unique "
+        "and quick to check at any size")(
+        "unique-node-limit", po::value<long>()->default_value(0),
+        "search nodes allowed to check uniqueness, 0 for no limit; puzzles "
+        "whose check runs out are rejected")(
+        "max-attempts", po::value<int>()->default_value(1000),
+        "random grids tried per unique puzzle")(
+        "binary,b", po::bool_switch()->default_value(false),
+        "write the binary format instead of text")(
+        "output-file,o", po::value<std::string>()->default_value("-"),
+        "output file, - for stdout");
+
+    po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+
+    if (vm["help"].as<bool>()) {
+      std::cout << desc << std::endl;
+      exit(0);
+    }
+
+    po::notify(vm);
+
+    Options options{
+        .generator = {.m_width = vm["width"].as<int>(),
+                      .m_height = vm["height"].as<int>(),
+                      .m_density = vm["density"].as<double>()},
+        .puzzles = vm["puzzles"].as<int>(),
+        .seed = vm["seed"].as<std::uint64_t>(),
+        .unique = vm["unique"].as<bool>(),
+        .line_solvable = vm["line-solvable"].as<bool>(),
+        .unique_node_limit =
+            std::max(0L, vm["unique-node-limit"].as<long>()),
+        .max_attempts = std::max(1, vm["max-attempts"].as<int>()),
+        .binary = vm["binary"].as<bool>(),
+        .output_file = vm["output-file"].as<std::string>(),
+    };
+    const auto &generator = options.generator;
+    if (generator.m_width < 1 || generator.m_width > 5000) {
+      throw po::validation_error(po::validation_error::invalid_option_value,
+                                 "width");
+    }
+    if (generator.m_height < 1 || generator.m_height > 5000) {
+      throw po::validation_error(po::validation_error::invalid_option_value,
+                                 "height");
+    }
+    if (generator.m_density < 0 || generator.m_density > 1) {
+      throw po::validation_error(po::validation_error::invalid_option_value,
+                                 "density");
+    }
+    return options;
+  } catch (const po::error &e) {
+    std::cerr << e.what() << std::endl;
+    exit(1);
+  }
+}
+
+bool is_line_solvable(const Puzzle &puzzle) {
+  reserve_line_scratch(puzzle);
+  Solution solution(puzzle.m_width, puzzle.m_height, puzzle.m_vertical_rules,
+                    puzzle.m_horizontal_rules);
+  return propagate(puzzle, solution) &&
+         !find_unknown_cell(solution).has_value();
+}
+
+bool is_accepted(const Options &options, const Puzzle &puzzle) {
+  if (options.line_solvable && !is_line_solvable(puzzle)) {
+    return false;
+  }
+  if (!options.unique) {
+    return true;
+  }
+  // a node limit rather than a time limit keeps the output reproducible
+  SolverStats stats;
+  auto result = count_solutions(
+      puzzle, 2, {.m_node_limit = options.unique_node_limit}, stats);
+  return !result.m_timed_out && result.m_count == 1;
+}
+
+std::optional<Puzzle> next_puzzle(const Options &options,
+                                  std::mt19937_64 &rng) {
+  for (int attempt = 0; attempt < options.max_attempts; ++attempt) {
+    auto puzzle = generate_puzzle(options.generator, rng);
+    if (is_accepted(options, puzzle)) {
+      return puzzle;
+    }
+  }
+  return std::nullopt;
+}
+
+int main(int argc, char **argv) {
+  auto options = parse_options(argc, argv);
+
+  std::ofstream file;
+  if (options.output_file != "-") {
+    file.open(options.output_file, std::ios::binary);
+    if (!file) {
+      std::cerr << "cannot open " << options.output_file << ": "
+                << std::strerror(errno) << std::endl;
+      return 1;
+    }
+  }
+  std::ostream &out = options.output_file == "-" ? std::cout : file;
+  auto write_error = [&] {
+    std::cerr << "cannot write " << options.output_file << std::endl;
+    return 1;
+  };
+
+  std::mt19937_64 rng(options.seed);
+  std::optional<BinaryWriter> writer;
+  if (options.binary) {
+    writer.emplace(out, BinaryKind::PUZZLES);
+  }
+  for (int k = 0; k < options.puzzles; ++k) {
+    auto puzzle = next_puzzle(options, rng);
+    if (!puzzle.has_value()) {
+      std::cerr << "no acceptable puzzle in " << options.max_attempts
+                << " attempts" << std::endl;
+      return 1;
+    }
+    if (writer.has_value()) {
+      writer->add(puzzle.value());
+    } else {
+      write_puzzle(out, puzzle.value());
+    }
+    if (!out) {
+      return write_error();
+    }
+  }
+  if (writer.has_value()) {
+    writer->finish();
+  }
+  if (!out.flush()) {
+    return write_error();
+  }
+
+  return 0;
+}
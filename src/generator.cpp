@@ -0,0 +1,43 @@
+#include "generator.hpp"
+
+namespace {
+
+// Appends the lengths of the runs of filled cells among cells[0], cells[step],
+// ... to rules
+void add_runs(const std::vector<char> &cells, int begin, int count, int step,
+              RulesLine &rules) {
+  int run = 0;
+  for (int k = 0; k < count; ++k) {
+    if (cells[begin + k * step]) {
+      ++run;
+    } else if (run > 0) {
+      rules.push_back(run);
+      run = 0;
+    }
+  }
+  if (run > 0) {
+    rules.push_back(run);
+  }
+}
+
+} // namespace
+
+Puzzle generate_puzzle(const GeneratorOptions &options, std::mt19937_64 &rng) {
+  int width = options.m_width;
+  int height = options.m_height;
+  std::bernoulli_distribution filled(options.m_density);
+  // row major
+  std::vector<char> cells(size_t{1} * width * height);
+  for (auto &cell : cells) {
+    cell = filled(rng);
+  }
+
+  Puzzle puzzle(width, height);
+  for (int i = 0; i < height; ++i) {
+    add_runs(cells, i * width, width, 1, puzzle.m_horizontal_rules[i]);
+  }
+  for (int j = 0; j < width; ++j) {
+    add_runs(cells, j, height, width, puzzle.m_vertical_rules[j]);
+  }
+  return puzzle;
+}
@@ -0,0 +1,336 @@
+#include "learning.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <numeric>
+
+namespace {
+
+// Ends the list of watches on a cell
+constexpr int kLastWatch = -1;
+// Watch not on any list
+constexpr int kUnlinked = -2;
+
+Cell other_value(Cell value) {
+  return value == Cell::FILLED ? Cell::EMPTY : Cell::FILLED;
+}
+
+bool holds(const Solution &solution, const Nogoods::Literal &literal) {
+  return solution.get_cell(literal.m_i, literal.m_j) == literal.m_value;
+}
+
+// The decision whose branch trail position t is in
+int decision_at(std::span<const size_t> decision_marks, long t) {
+  return static_cast<int>(std::upper_bound(decision_marks.begin(),
+                                           decision_marks.end(), t) -
+                          decision_marks.begin()) -
+         1;
+}
+
+} // namespace
+
+Nogoods::Nogoods(size_t capacity, int width, int height)
+    : m_capacity(capacity), m_width(width),
+      m_first_watch(static_cast<size_t>(width) * height, kLastWatch) {}
+
+bool Nogoods::add(std::span<const Literal> literals) {
+  if (size() >= m_capacity || literals.size() > kMaxLiterals) {
+    return false;
+  }
+  int k = size();
+  m_literals.insert(m_literals.end(), literals.begin(), literals.end());
+  m_starts.push_back(m_literals.size());
+  m_watched.insert(m_watched.end(), 2, m_starts[k]);
+  m_next_watch.insert(m_next_watch.end(), 2, kUnlinked);
+  (literals.size() < 2 ? m_units : m_pending).push_back(k);
+  return true;
+}
+
+std::span<const Nogoods::Literal> Nogoods::get(int k) const {
+  return std::span(m_literals)
+      .subspan(m_starts[k], m_starts[k + 1] - m_starts[k]);
+}
+
+void Nogoods::link_watch(int watch) {
+  auto &first = m_first_watch[cell_index(m_literals[m_watched[watch]])];
+  m_next_watch[watch] = first;
+  first = watch;
+}
+
+void Nogoods::unlink_watch(int watch) {
+  if (m_next_watch[watch] == kUnlinked) {
+    return;
+  }
+  auto *link = &m_first_watch[cell_index(m_literals[m_watched[watch]])];
+  while (*link != watch) {
+    link = &m_next_watch[*link];
+  }
+  *link = m_next_watch[watch];
+  m_next_watch[watch] = kUnlinked;
+}
+
+bool Nogoods::check(Solution &solution, int k, SolverStats &stats) {
+  unlink_watch(2 * k);
+  unlink_watch(2 * k + 1);
+  // up to two literals that do not hold
+  std::array<size_t, 2> open;
+  int n_open = 0;
+  for (auto l = m_starts[k]; l < m_starts[k + 1] && n_open < 2; ++l) {
+    if (!holds(solution, m_literals[l])) {
+      open[n_open++] = l;
+    }
+  }
+  if (n_open < 2) {
+    // a watch is left on a literal that holds, which undoing may open again
+    m_rechecks.emplace_back(solution.m_trail.mark(), k);
+  }
+  if (n_open == 0) {
+    solution.m_conflict = Trail::kFirstNogood - k;
+    return false;
+  }
+  m_watched[2 * k] = open[0];
+  m_watched[2 * k + 1] =
+      n_open == 2 ? open[1]
+                  : m_starts[k] + (open[0] == m_starts[k] ? 1 : 0);
+  link_watch(2 * k);
+  link_watch(2 * k + 1);
+  const auto &last = m_literals[open[0]];
+  if (n_open == 1 &&
+      solution.get_cell(last.m_i, last.m_j) == Cell::UNKNOWN) {
+    solution.set_cell(last.m_i, last.m_j, other_value(last.m_value),
+                      Trail::kFirstNogood - k);
+    ++stats.m_nogood_fixed_cells;
+  }
+  return true;
+}
+
+bool Nogoods::on_watch_held(Solution &solution, int watch, bool &moved,
+                            SolverStats &stats) {
+  const int k = watch / 2;
+  const auto other = m_watched[watch ^ 1];
+  for (auto l = m_starts[k]; l < m_starts[k + 1]; ++l) {
+    if (l != m_watched[watch] && l != other &&
+        !holds(solution, m_literals[l])) {
+      m_watched[watch] = l;
+      moved = true;
+      return true;
+    }
+  }
+  moved = false;
+  const auto &last = m_literals[other];
+  auto cell = solution.get_cell(last.m_i, last.m_j);
+  if (cell == last.m_value) {
+    solution.m_conflict = Trail::kFirstNogood - k;
+    return false;
+  }
+  if (cell == Cell::UNKNOWN) {
+    solution.set_cell(last.m_i, last.m_j, other_value(last.m_value),
+                      Trail::kFirstNogood - k);
+    ++stats.m_nogood_fixed_cells;
+  }
+  return true;
+}
+
+bool Nogoods::propagate(Solution &solution, SolverStats &stats) {
+  auto &trail = solution.m_trail;
+  // cells undone since the last call are looked at again when fixed anew
+  m_checked = std::min(m_checked, trail.m_undone_to);
+  while (!m_rechecks.empty() &&
+         m_rechecks.back().first >= trail.m_undone_to) {
+    m_pending.push_back(m_rechecks.back().second);
+    m_rechecks.pop_back();
+  }
+  trail.m_undone_to = trail.mark();
+
+  for (auto k : m_units) {
+    auto literals = get(k);
+    if (literals.empty() || holds(solution, literals[0])) {
+      solution.m_conflict = Trail::kFirstNogood - k;
+      return false;
+    }
+    if (solution.get_cell(literals[0].m_i, literals[0].m_j) == Cell::UNKNOWN) {
+      solution.set_cell(literals[0].m_i, literals[0].m_j,
+                        other_value(literals[0].m_value),
+                        Trail::kFirstNogood - k);
+      ++stats.m_nogood_fixed_cells;
+    }
+  }
+  while (!m_pending.empty()) {
+    auto k = m_pending.back();
+    m_pending.pop_back();
+    if (!check(solution, k, stats)) {
+      return false;
+    }
+  }
+
+  // fixing cells appends to the trail, so entries are copied out
+  while (m_checked < trail.mark()) {
+    auto entry = trail.m_entries[m_checked++];
+    if (entry.m_kind != Trail::Entry::Kind::CELL) {
+      continue;
+    }
+    auto value = solution.get_cell(entry.m_a, entry.m_b);
+    auto *link = &m_first_watch[entry.m_a * m_width + entry.m_b];
+    while (*link != kLastWatch) {
+      int watch = *link;
+      if (m_literals[m_watched[watch]].m_value != value) {
+        link = &m_next_watch[watch];
+        continue;
+      }
+      bool moved;
+      if (!on_watch_held(solution, watch, moved, stats)) {
+        return false;
+      }
+      if (moved) {
+        *link = m_next_watch[watch];
+        link_watch(watch);
+      } else {
+        link = &m_next_watch[watch];
+      }
+    }
+  }
+  return true;
+}
+
+ConflictAnalysis::ConflictAnalysis(const Solution &solution)
+    : m_width(solution.m_width),
+      m_positions(static_cast<size_t>(solution.m_width) * solution.m_height,
+                  -1) {
+  for (int line = 0; line < solution.m_width + solution.m_height; ++line) {
+    const auto &state = solution.get_line(line);
+    m_lines.emplace_back(state.size(), state.m_rules);
+  }
+}
+
+void ConflictAnalysis::explain_line(const Solution &solution, int line,
+                                   long limit) {
+  const auto &entries = solution.m_trail.m_entries;
+  const auto &state = m_lines[line];
+  const int n = state.size();
+  const bool is_row = line < solution.m_height;
+  auto position = [&](int k) {
+    return is_row ? m_positions[line * m_width + k]
+                  : m_positions[k * m_width + line - solution.m_height];
+  };
+
+  int target = -1;
+  Cell target_value = Cell::UNKNOWN;
+  if (limit < entries.size()) {
+    const auto &entry = entries[limit];
+    target = is_row ? entry.m_b : entry.m_a;
+    target_value = solution.get_cell(entry.m_a, entry.m_b);
+  }
+  // the line as it was solved; cells fixed before the first decision stay
+  m_line = PackedLine(n);
+  m_candidates.clear();
+  for (int k = 0; k < n; ++k) {
+    auto t = position(k);
+    auto value = is_row ? solution.get_cell(line, k)
+                        : solution.get_cell(k, line - solution.m_height);
+    if (value == Cell::UNKNOWN || t >= limit) {
+      continue;
+    }
+    m_line.set(k, value);
+    if (t >= 0) {
+      m_candidates.push_back(k);
+    }
+  }
+  auto still_holds = [&] {
+    update_cells(state, m_line, m_result);
+    return target < 0 ? !m_result.m_rules_fit
+                      : m_result.m_rules_fit &&
+                            m_result.m_cells[target] == target_value;
+  };
+  auto mark = [&](int k) { m_marked[position(k)] = 1; };
+  if (!still_holds()) {
+    // some other solver found it, e.g. from a placement table
+    std::ranges::for_each(m_candidates, mark);
+    return;
+  }
+  // leaving out the latest cells first lets the explanation reach back as
+  // far as it can
+  std::ranges::sort(m_candidates, std::greater{}, position);
+  for (auto k : m_candidates) {
+    auto value = m_line.get(k);
+    m_line.set(k, Cell::UNKNOWN);
+    if (!still_holds()) {
+      m_line.set(k, value);
+      mark(k);
+    }
+  }
+}
+
+std::vector<int>
+ConflictAnalysis::decisions(const Solution &solution,
+                            std::span<const size_t> decision_marks,
+                            const Nogoods &nogoods) {
+  std::vector<int> result;
+  if (solution.m_conflict == Trail::kUnknownReason) {
+    result.resize(decision_marks.size());
+    std::iota(result.begin(), result.end(), 0);
+    return result;
+  }
+  if (decision_marks.empty()) {
+    return result;
+  }
+  const auto &entries = solution.m_trail.m_entries;
+  const long end = entries.size();
+  const long first = decision_marks.front();
+  m_marked.assign(end, 0);
+  for (long t = first; t < end; ++t) {
+    if (entries[t].m_kind == Trail::Entry::Kind::CELL) {
+      m_positions[entries[t].m_a * m_width + entries[t].m_b] = t;
+    }
+  }
+
+  // marks the cells of a reason fixed before position limit; cells fixed
+  // before the first decision follow from the puzzle alone
+  auto mark_cell = [&](int i, int j, long limit) {
+    auto t = m_positions[i * m_width + j];
+    if (t >= 0 && t < limit) {
+      m_marked[t] = 1;
+    }
+  };
+  auto mark_reason = [&](int reason, long limit) {
+    if (reason >= 0) {
+      explain_line(solution, reason, limit);
+    } else {
+      assert(reason <= Trail::kFirstNogood);
+      for (const auto &literal : nogoods.get(Trail::kFirstNogood - reason)) {
+        mark_cell(literal.m_i, literal.m_j, limit);
+      }
+    }
+  };
+
+  mark_reason(solution.m_conflict, end);
+  // reasons only point back, so one pass from the end visits every cell the
+  // conflict follows from after all cells that follow from it
+  int explained = 0;
+  for (long t = end - 1; t >= first; --t) {
+    if (!m_marked[t]) {
+      continue;
+    }
+    auto reason = entries[t].m_reason;
+    if (reason == Trail::kDecision) {
+      result.push_back(decision_at(decision_marks, t));
+    } else if (reason == Trail::kUnknownReason ||
+               explained++ == kMaxExplainedCells) {
+      for (int d = decision_at(decision_marks, t); d >= 0; --d) {
+        result.push_back(d);
+      }
+      break;
+    } else {
+      mark_reason(reason, t);
+    }
+  }
+
+  for (long t = first; t < end; ++t) {
+    if (entries[t].m_kind == Trail::Entry::Kind::CELL) {
+      m_positions[entries[t].m_a * m_width + entries[t].m_b] = -1;
+    }
+  }
+  std::sort(result.begin(), result.end());
+  result.erase(std::unique(result.begin(), result.end()), result.end());
+  return result;
+}
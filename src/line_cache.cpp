@@ -0,0 +1,137 @@
+#include "line_cache.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+
+namespace {
+
+void append_varint(std::string &out, unsigned value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+// Appends 2 bits per cell, 4 cells per byte
+void append_packed_cells(std::string &out, const CellsLine &cells) {
+  for (size_t k = 0; k < cells.size(); k += 4) {
+    unsigned byte = 0;
+    for (size_t b = 0; b < 4 && k + b < cells.size(); ++b) {
+      byte |= static_cast<unsigned>(cells[k + b]) << (2 * b);
+    }
+    out.push_back(static_cast<char>(byte));
+  }
+}
+
+void unpack_cells(const std::string &packed, CellsLine &cells) {
+  for (size_t k = 0; k < cells.size(); ++k) {
+    auto byte = static_cast<unsigned char>(packed[k / 4]);
+    cells[k] = static_cast<Cell>((byte >> (2 * (k % 4))) & 3);
+  }
+}
+
+void append_words(std::string &out,
+                  const std::vector<PackedLine::Word> &words) {
+  out.append(reinterpret_cast<const char *>(words.data()),
+             words.size() * sizeof(PackedLine::Word));
+}
+
+// Rules as varints (all rules are positive, so a 0 byte ends them), then the
+// line length and the bit planes of the cells
+void make_key(const RulesLine &rules, const PackedLine &cells,
+              std::string &key) {
+  key.clear();
+  for (auto rule : rules) {
+    append_varint(key, rule);
+  }
+  key.push_back(0);
+  append_varint(key, cells.size());
+  append_words(key, cells.m_filled);
+  append_words(key, cells.m_empty);
+}
+
+std::string &key_buffer() {
+  thread_local std::string key;
+  return key;
+}
+
+} // namespace
+
+LineCache::LineCache(size_t capacity)
+    : m_shard_capacity(std::max<size_t>(1, capacity / kShards)) {}
+
+bool LineCache::lookup(const RulesLine &rules, const PackedLine &cells,
+                       UpdateResult &result) {
+  auto &key = key_buffer();
+  make_key(rules, cells, key);
+  auto &shard = m_shards[std::hash<std::string>{}(key) % kShards];
+
+  std::lock_guard lock(shard.m_mutex);
+  auto it = shard.m_index.find(key);
+  if (it == shard.m_index.end()) {
+    ++m_misses;
+    return false;
+  }
+  ++m_hits;
+  shard.m_lru.splice(shard.m_lru.begin(), shard.m_lru, it->second);
+
+  const auto &value = it->second->m_value;
+  result.m_rules_fit = value.m_rules_fit;
+  result.m_line_updated = value.m_line_updated;
+  result.m_line_solved = value.m_line_solved;
+  result.m_dp_states = 0;
+  result.m_fits_computed = 0;
+  result.m_fits_reused = 0;
+  if (!value.m_rules_fit) {
+    return true;
+  }
+  result.m_cells.resize(cells.size());
+  unpack_cells(value.m_cells, result.m_cells);
+  if (!result.m_lfit.has_value()) {
+    result.m_lfit.emplace();
+  }
+  if (!result.m_rfit.has_value()) {
+    result.m_rfit.emplace();
+  }
+  result.m_lfit->assign(value.m_lfit.begin(), value.m_lfit.end());
+  result.m_rfit->assign(value.m_rfit.begin(), value.m_rfit.end());
+  return true;
+}
+
+void LineCache::insert(const RulesLine &rules, const PackedLine &cells,
+                       const UpdateResult &result) {
+  Entry entry;
+  make_key(rules, cells, entry.m_key);
+  entry.m_value = {.m_rules_fit = result.m_rules_fit,
+                   .m_line_updated = result.m_line_updated,
+                   .m_line_solved = result.m_line_solved};
+  if (result.m_rules_fit) {
+    append_packed_cells(entry.m_value.m_cells, result.m_cells);
+    entry.m_value.m_lfit = *result.m_lfit;
+    entry.m_value.m_rfit = *result.m_rfit;
+  }
+  auto &shard = m_shards[std::hash<std::string>{}(entry.m_key) % kShards];
+
+  std::lock_guard lock(shard.m_mutex);
+  if (shard.m_index.contains(entry.m_key)) {
+    // another thread got there first
+    return;
+  }
+  shard.m_lru.push_front(std::move(entry));
+  shard.m_index.emplace(shard.m_lru.front().m_key, shard.m_lru.begin());
+  if (shard.m_lru.size() > m_shard_capacity) {
+    shard.m_index.erase(shard.m_lru.back().m_key);
+    shard.m_lru.pop_back();
+    ++m_evictions;
+  }
+}
+
+size_t LineCache::size() const {
+  size_t size = 0;
+  for (const auto &shard : m_shards) {
+    size += shard.m_lru.size();
+  }
+  return size;
+}
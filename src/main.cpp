@@ -1,18 +1,99 @@
+#include "alloc_counter.hpp"
+#include "batch.hpp"
+#include "binary_format.hpp"
+#include "line_cache.hpp"
 #include "nonogram.hpp"
+#include "puzzle_parser.hpp"
+#include "server.hpp"
 
 #include <boost/program_options.hpp>
 
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <csignal>
 #include <cstdlib>
 #include <fstream>
+#include <sstream>
+#include <thread>
 
 namespace po = boost::program_options;
 
 struct Options {
   bool quiet;
   bool benchmark;
+  bool stats;
+  bool batch;
+  bool parse_only;
+  int jobs;
+  bool ordered;
+  long count;
+  std::string convert_file;
+  std::string solutions_file;
+  std::string serve;
   std::string input_file;
+  SolverOptions solver;
 };
 
+PropagationOrder parse_propagation_order(const std::string &name) {
+  if (name == "sweep") {
+    return PropagationOrder::SWEEP;
+  }
+  if (name == "fifo") {
+    return PropagationOrder::FIFO;
+  }
+  if (name == "fixed") {
+    return PropagationOrder::NEWLY_FIXED;
+  }
+  if (name == "slack") {
+    return PropagationOrder::SLACK;
+  }
+  throw po::validation_error(po::validation_error::invalid_option_value,
+                             "propagation-order", name);
+}
+
+bool parse_batch_order(const std::string &name) {
+  if (name == "input") {
+    return true;
+  }
+  if (name == "completed") {
+    return false;
+  }
+  throw po::validation_error(po::validation_error::invalid_option_value,
+                             "batch-order", name);
+}
+
+BranchCell parse_branch_cell(const std::string &name) {
+  if (name == "first") {
+    return BranchCell::FIRST;
+  }
+  if (name == "constrained") {
+    return BranchCell::MOST_CONSTRAINED_LINE;
+  }
+  if (name == "blocks") {
+    return BranchCell::MOST_CANDIDATE_BLOCKS;
+  }
+  throw po::validation_error(po::validation_error::invalid_option_value,
+                             "branch", name);
+}
+
+BranchValue parse_branch_value(const std::string &name) {
+  if (name == "filled") {
+    return BranchValue::FILLED_FIRST;
+  }
+  if (name == "empty") {
+    return BranchValue::EMPTY_FIRST;
+  }
+  if (name == "likely") {
+    return BranchValue::LIKELIHOOD;
+  }
+  throw po::validation_error(po::validation_error::invalid_option_value,
+                             "value-order", name);
+}
+
 Options parse_options(int argc, char **argv) {
   po::variables_map vm;
   try {
@@ -21,8 +102,55 @@ Options parse_options(int argc, char **argv) {
                        "produce help message")(
         "quiet,q", po::bool_switch()->default_value(false), "quiet mode")(
         "benchmark,b", po::bool_switch()->default_value(false),
-        "benchmark mode")("input-file", po::value<std::string>()->required(),
-                          "input file");
+        "benchmark mode")(
+        "stats", po::bool_switch()->default_value(false),
+        "print solver counters and phase times as JSON")(
+        "batch", po::bool_switch()->default_value(false),
+        "solve every puzzle of the input, which may be - for stdin")(
+        "jobs,j",
+        po::value<int>()->default_value(std::thread::hardware_concurrency()),
+        "puzzles solved at the same time in batch mode")(
+        "batch-order", po::value<std::string>()->default_value("input"),
+        "order of batch results: input or completed")(
+        "parse-only", po::bool_switch()->default_value(false),
+        "only parse the input and report the parsers' throughput")(
+        "convert", po::value<std::string>()->default_value(""),
+        "write the input to this file, text puzzles as binary, binary puzzles "
+        "or solutions as text")(
+        "solutions-out", po::value<std::string>()->default_value(""),
+        "write batch solutions to this binary file, in input order")(
+        "count", po::value<long>()->default_value(0),
+        "count solutions up to this limit, 2 checks uniqueness, 0 solves")(
+        "propagation-order", po::value<std::string>()->default_value("fifo"),
+        "order of line solves: sweep, fifo, fixed or slack")(
+        "threads,t", po::value<int>()->default_value(1),
+        "threads used to solve lines")(
+        "search-threads", po::value<int>()->default_value(1),
+        "threads used to explore search branches")(
+        "branch", po::value<std::string>()->default_value("first"),
+        "branching cell: first, constrained or blocks")(
+        "value-order", po::value<std::string>()->default_value("filled"),
+        "value tried first: filled, empty or likely")(
+        "probe-budget", po::value<int>()->default_value(0),
+        "unknown cells probed before each branching, 0 disables probing")(
+        "line-cache", po::value<size_t>()->default_value(0),
+        "lines kept in the line solve cache, 0 disables caching")(
+        "placement-tables", po::value<int>()->default_value(0),
+        "solve lines of up to this many cells, at most 32, from tables of "
+        "their placements; 0 disables the tables")(
+        "time-limit", po::value<long>()->default_value(0),
+        "milliseconds allowed per puzzle, 0 for no limit; a puzzle that runs "
+        "out prints the cells fixed by propagation and exits with status 3")(
+        "node-limit", po::value<long>()->default_value(0),
+        "search nodes allowed per puzzle, 0 for no limit")(
+        "learn", po::bool_switch()->default_value(false),
+        "learn nogoods from failed branches and backjump over the decisions "
+        "they do not depend on; serial search only")(
+        "serve", po::value<std::string>()->default_value(""),
+        "answer framed solve requests on this Unix socket, or on stdin and "
+        "stdout if -, with --jobs warm solver threads, until interrupted")(
+        "input-file", po::value<std::string>(),
+        "input file, not needed with --serve");
 
     po::positional_options_description pos_desc;
     pos_desc.add("input-file", 1);
@@ -39,47 +167,458 @@ Options parse_options(int argc, char **argv) {
     }
 
     po::notify(vm);
+    if (vm["serve"].as<std::string>().empty() && !vm.count("input-file")) {
+      throw po::required_option("input-file");
+    }
+
+    return {
+        .quiet = vm["quiet"].as<bool>(),
+        .benchmark = vm["benchmark"].as<bool>(),
+        .stats = vm["stats"].as<bool>(),
+        .batch = vm["batch"].as<bool>(),
+        .parse_only = vm["parse-only"].as<bool>(),
+        .jobs = std::max(1, vm["jobs"].as<int>()),
+        .ordered = parse_batch_order(vm["batch-order"].as<std::string>()),
+        .count = std::max(0L, vm["count"].as<long>()),
+        .convert_file = vm["convert"].as<std::string>(),
+        .solutions_file = vm["solutions-out"].as<std::string>(),
+        .serve = vm["serve"].as<std::string>(),
+        .input_file =
+            vm.count("input-file") ? vm["input-file"].as<std::string>() : "",
+        .solver = {.m_propagation_order = parse_propagation_order(
+                       vm["propagation-order"].as<std::string>()),
+                   .m_threads = std::max(1, vm["threads"].as<int>()),
+                   .m_search_threads =
+                       std::max(1, vm["search-threads"].as<int>()),
+                   .m_branch_cell =
+                       parse_branch_cell(vm["branch"].as<std::string>()),
+                   .m_branch_value = parse_branch_value(
+                       vm["value-order"].as<std::string>()),
+                   .m_probe_budget = std::max(0, vm["probe-budget"].as<int>()),
+                   .m_line_cache_capacity = vm["line-cache"].as<size_t>(),
+                   .m_placement_table_cells =
+                       std::max(0, vm["placement-tables"].as<int>()),
+                   .m_time_limit = std::chrono::milliseconds(
+                       std::max(0L, vm["time-limit"].as<long>())),
+                   .m_node_limit = std::max(0L, vm["node-limit"].as<long>()),
+                   .m_learning = vm["learn"].as<bool>()},
+    };
   } catch (const po::error &e) {
     std::cerr << e.what() << std::endl;
     exit(1);
   }
+}
 
-  return {
-      .quiet = vm["quiet"].as<bool>(),
-      .benchmark = vm["benchmark"].as<bool>(),
-      .input_file = vm["input-file"].as<std::string>(),
-  };
+// Exit status of a single puzzle run; 1 is taken by input errors
+int exit_status(SolveStatus status) {
+  switch (status) {
+  case SolveStatus::SOLVED:
+    return 0;
+  case SolveStatus::UNSOLVABLE:
+    return 2;
+  case SolveStatus::TIMED_OUT:
+    return 3;
+  }
+  return 1;
 }
 
-int main(int argc, char **argv) {
-  auto options = parse_options(argc, argv);
+const char *status_name(SolveStatus status) {
+  switch (status) {
+  case SolveStatus::SOLVED:
+    return "solved";
+  case SolveStatus::UNSOLVABLE:
+    return "unsolvable";
+  case SolveStatus::TIMED_OUT:
+    return "timed out";
+  }
+  return "";
+}
+
+long nanoseconds_since(std::chrono::steady_clock::time_point begin) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - begin)
+      .count();
+}
 
-  std::ifstream file(options.input_file);
+// Time spent in each phase of a run, -1 if the phase was not measured
+struct PhaseTimes {
+  long parse_ns{-1};
+  long solve_ns{0};
+  long print_ns{-1};
+};
 
-  auto p = read_puzzle(file);
-  if (!options.quiet) {
-    print_puzzle(std::cout, p);
+// Prints the solver counters and phase times as a single line JSON object.
+// The search time is the solve time not spent propagating. The propagation
+// time of a parallel search is summed over its threads, so only its whole
+// solve time is printed.
+void print_stats_json(std::ostream &out, const SolverStats &stats,
+                      const PhaseTimes &times) {
+  out << "{\"propagation_rounds\":" << stats.m_propagation_rounds
+      << ",\"line_solves\":" << stats.m_line_solves
+      << ",\"line_solves_skipped\":" << stats.m_line_solves_skipped
+      << ",\"update_cells\":{\"rows\":" << stats.m_row_updates
+      << ",\"columns\":" << stats.m_column_updates << "}"
+      << ",\"dp_states\":" << stats.m_dp_states
+      << ",\"fits\":{\"computed\":" << stats.m_fits_computed
+      << ",\"reused\":" << stats.m_fits_reused << "}"
+      << ",\"fixed_cells\":{\"propagation\":"
+      << stats.m_propagation_fixed_cells
+      << ",\"search\":" << stats.m_search_fixed_cells
+      << ",\"probing\":" << stats.m_probe_fixed_cells
+      << ",\"nogoods\":" << stats.m_nogood_fixed_cells << "}"
+      << ",\"probes\":" << stats.m_probes
+      << ",\"search\":{\"nodes\":" << stats.m_search_nodes
+      << ",\"max_depth\":" << stats.m_max_depth
+      << ",\"backtracks\":" << stats.m_backtracks
+      << ",\"backjumped_levels\":" << stats.m_backjumped_levels
+      << ",\"nogoods\":" << stats.m_nogoods << "}"
+      << ",\"placement_table_bytes\":" << stats.m_placement_table_bytes
+      << ",\"time_ns\":{";
+  if (times.parse_ns >= 0) {
+    out << "\"parse\":" << times.parse_ns << ",";
+  }
+  if (stats.m_thread_nodes.empty()) {
+    out << "\"propagate\":" << stats.m_propagate_ns << ",\"search\":"
+        << std::max(0L, times.solve_ns - stats.m_propagate_ns);
+  } else {
+    out << "\"solve\":" << times.solve_ns;
+  }
+  if (times.print_ns >= 0) {
+    out << ",\"print\":" << times.print_ns;
   }
+  out << "}}" << std::endl;
+}
 
-  std::optional<Solution> s;
+int run_batch(const Options &options, const PuzzleSource &next_puzzle,
+              LineCache *cache) {
+  std::ofstream solutions_file;
+  std::optional<BinaryWriter> solutions_out;
+  if (!options.solutions_file.empty()) {
+    solutions_file.open(options.solutions_file, std::ios::binary);
+    solutions_out.emplace(solutions_file, BinaryKind::SOLUTIONS);
+  }
+  auto summary = solve_batch(
+      next_puzzle,
+      {.m_solver = options.solver,
+       .m_jobs = options.jobs,
+       // solutions are written in input order
+       .m_ordered = options.ordered || solutions_out.has_value(),
+       .m_solution_limit = options.count,
+       .m_time_phases = options.stats},
+      [&](BatchResult &result) {
+        std::cout << "puzzle " << result.m_index << ": "
+                  << status_name(result.m_status) << " in "
+                  << result.m_solve_ns << " ns, search nodes "
+                  << result.m_stats.m_search_nodes;
+        if (options.count > 0) {
+          std::cout << ", solutions " << result.m_solution_count;
+        }
+        std::cout << std::endl;
+        if (!options.quiet) {
+          print_solution(std::cout, result.m_solution.value());
+        }
+        if (options.stats) {
+          print_stats_json(std::cout, result.m_stats,
+                           {.solve_ns = result.m_solve_ns});
+        }
+        if (solutions_out.has_value()) {
+          solutions_out->add(result.m_solution.value());
+        }
+      },
+      cache);
+  if (solutions_out.has_value()) {
+    solutions_out->finish();
+  }
   if (options.benchmark) {
-    auto begin = std::chrono::high_resolution_clock::now();
-    s = solve_puzzle(p);
-    auto end = std::chrono::high_resolution_clock::now();
-    std::cout << "solve_puzzle took "
+    std::cout << "batch: " << summary.m_puzzles << " puzzles, "
+              << summary.m_solved << " solved in " << summary.m_wall_ns
+              << " ns" << std::endl;
+  }
+  return 0;
+}
+
+int run_count(const Options &options, const Puzzle &puzzle, LineCache *cache,
+              PhaseTimes &times) {
+  SolverStats stats;
+  stats.m_time_phases = options.stats;
+  auto begin = std::chrono::high_resolution_clock::now();
+  auto result =
+      count_solutions(puzzle, options.count, options.solver, stats, cache);
+  auto end = std::chrono::high_resolution_clock::now();
+  times.solve_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+  std::cout << "solutions: " << result.m_count;
+  if (result.m_count == options.count) {
+    std::cout << " (limit reached)";
+  } else if (result.m_timed_out) {
+    std::cout << " (timed out)";
+  }
+  std::cout << std::endl;
+  if (options.benchmark) {
+    std::cout << "count_solutions took "
               << std::chrono::duration_cast<std::chrono::nanoseconds>(end -
                                                                       begin)
                      .count()
               << " ns" << std::endl;
+    std::cout << "search nodes: " << stats.m_search_nodes << std::endl;
+  }
+  auto print_begin = std::chrono::steady_clock::now();
+  if (!options.quiet) {
+    for (const auto &witness : result.m_witnesses) {
+      std::cout << std::endl;
+      print_solution(std::cout, witness);
+    }
+  }
+  if (options.stats) {
+    times.print_ns = nanoseconds_since(print_begin);
+    print_stats_json(std::cout, stats, times);
+  }
+  return result.m_timed_out ? exit_status(SolveStatus::TIMED_OUT) : 0;
+}
+
+int run_solve(const Options &options, const Puzzle &puzzle, LineCache *cache,
+              PhaseTimes times) {
+  if (!options.quiet) {
+    print_puzzle(std::cout, puzzle);
+  }
+
+  if (options.count > 0) {
+    return run_count(options, puzzle, cache, times);
+  }
+
+  std::optional<Solution> s;
+  SolverStats stats;
+  stats.m_time_phases = options.stats;
+  if (options.benchmark) {
+    auto allocations_before = allocation_count();
+    auto begin = std::chrono::high_resolution_clock::now();
+    s = solve_puzzle(puzzle, options.solver, stats, cache);
+    auto end = std::chrono::high_resolution_clock::now();
+    auto allocations = allocation_count() - allocations_before;
+    times.solve_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin)
+            .count();
+    std::cout << "solve_puzzle took " << times.solve_ns << " ns"
+              << std::endl;
+    std::cout << "solve_puzzle allocations: " << allocations << std::endl;
+    std::cout << "line solves: " << stats.m_line_solves
+              << " skipped: " << stats.m_line_solves_skipped << std::endl;
+    std::cout << "long line fits computed: " << stats.m_fits_computed
+              << " reused: " << stats.m_fits_reused << std::endl;
+    std::cout << "probes: " << stats.m_probes
+              << " fixed cells: " << stats.m_probe_fixed_cells << std::endl;
+    if (cache != nullptr) {
+      std::cout << "line cache hits: " << cache->m_hits
+                << " misses: " << cache->m_misses
+                << " evictions: " << cache->m_evictions << std::endl;
+    }
+    if (options.solver.m_learning) {
+      std::cout << "nogoods: " << stats.m_nogoods
+                << " fixed cells: " << stats.m_nogood_fixed_cells
+                << " backjumped levels: " << stats.m_backjumped_levels
+                << std::endl;
+    }
+    if (options.solver.m_placement_table_cells > 0) {
+      std::cout << "placement table bytes: "
+                << stats.m_placement_table_bytes << std::endl;
+    }
+    std::cout << "search nodes: " << stats.m_search_nodes;
+    if (!stats.m_thread_nodes.empty()) {
+      std::cout << " per thread:";
+      for (auto nodes : stats.m_thread_nodes) {
+        std::cout << " " << nodes;
+      }
+    }
+    std::cout << std::endl;
   } else {
-    s = solve_puzzle(p);
+    auto begin = std::chrono::steady_clock::now();
+    s = solve_puzzle(puzzle, options.solver, stats, cache);
+    times.solve_ns = nanoseconds_since(begin);
   }
 
   assert(s.has_value());
+  auto print_begin = std::chrono::steady_clock::now();
   if (!options.quiet) {
     print_solution(std::cout, s.value());
   }
-  assert(s->m_is_final);
+  if (options.stats) {
+    times.print_ns = nanoseconds_since(print_begin);
+    print_stats_json(std::cout, stats, times);
+  }
+  if (s->m_status != SolveStatus::SOLVED) {
+    std::cerr << options.input_file << ": " << status_name(s->m_status)
+              << std::endl;
+  }
+  return exit_status(s->m_status);
+}
+
+std::atomic<bool> stop_serving{false};
 
+// Serves until stdin ends, or until SIGINT or SIGTERM when serving a socket
+int run_serve(const Options &options) {
+  // answers to a client that went away are dropped rather than fatal
+  std::signal(SIGPIPE, SIG_IGN);
+  SolverServer server({.m_solver = options.solver, .m_jobs = options.jobs});
+  auto begin = std::chrono::steady_clock::now();
+  if (options.serve == "-") {
+    server.serve(STDIN_FILENO, STDOUT_FILENO);
+  } else {
+    for (int signal : {SIGINT, SIGTERM}) {
+      std::signal(signal, [](int) { stop_serving = true; });
+    }
+    if (!options.quiet) {
+      std::cerr << "serving on " << options.serve << std::endl;
+    }
+    server.serve_socket(options.serve, stop_serving);
+  }
+  if (options.benchmark) {
+    std::cerr << "served " << server.m_requests << " requests in "
+              << nanoseconds_since(begin) << " ns" << std::endl;
+  }
   return 0;
 }
+
+int run_parse(const Options &options) {
+  MappedFile file(options.input_file);
+  auto data = file.data();
+  auto throughput = [&](const std::string &name, auto &&next_puzzle) {
+    auto begin = std::chrono::high_resolution_clock::now();
+    int puzzles = 0;
+    while (next_puzzle().has_value()) {
+      ++puzzles;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    auto ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin)
+            .count();
+    std::cout << name << ": " << puzzles << " puzzles, " << data.size()
+              << " bytes in " << ns << " ns, "
+              << data.size() * 1e3 / std::max<long>(ns, 1) << " MB/s"
+              << std::endl;
+  };
+  if (is_binary(data, BinaryKind::PUZZLES)) {
+    std::optional<BinaryReader> reader;
+    size_t next = 0;
+    throughput("binary reader", [&]() -> std::optional<Puzzle> {
+      if (!reader.has_value()) {
+        reader.emplace(data, BinaryKind::PUZZLES);
+      }
+      if (next == reader->size()) {
+        return std::nullopt;
+      }
+      return reader->puzzle(next++);
+    });
+    return 0;
+  }
+  PuzzleParser parser(data);
+  throughput("mapped parser", [&] { return parser.next(); });
+  std::istringstream stream{std::string(data)};
+  throughput("stream parser", [&] { return read_next_puzzle(stream); });
+  return 0;
+}
+
+// Puzzles of an input file in the text or the binary format
+struct PuzzleFile {
+  explicit PuzzleFile(const std::string &path) : m_file(path) {
+    if (is_binary(m_file.data(), BinaryKind::PUZZLES)) {
+      m_reader.emplace(m_file.data(), BinaryKind::PUZZLES);
+    }
+  }
+
+  std::optional<Puzzle> next() {
+    if (!m_reader.has_value()) {
+      return m_parser.next();
+    }
+    if (m_next == m_reader->size()) {
+      return std::nullopt;
+    }
+    return m_reader->puzzle(m_next++);
+  }
+
+  MappedFile m_file;
+  PuzzleParser m_parser{m_file.data()};
+  std::optional<BinaryReader> m_reader;
+  size_t m_next{0};
+};
+
+// Converts text puzzles to binary ones, and binary puzzles or solutions to
+// text
+int run_convert(const Options &options) {
+  MappedFile file(options.input_file);
+  std::ofstream out(options.convert_file, std::ios::binary);
+  auto data = file.data();
+  size_t records = 0;
+  if (is_binary(data, BinaryKind::SOLUTIONS)) {
+    BinaryReader reader(data, BinaryKind::SOLUTIONS);
+    for (; records < reader.size(); ++records) {
+      auto grid = reader.solution(records);
+      out << "solution " << records << ": "
+          << (grid.m_solved ? "solved" : "unsolved") << std::endl;
+      print_solution(out, grid);
+    }
+  } else if (is_binary(data, BinaryKind::PUZZLES)) {
+    BinaryReader reader(data, BinaryKind::PUZZLES);
+    for (; records < reader.size(); ++records) {
+      write_puzzle(out, reader.puzzle(records));
+    }
+  } else {
+    PuzzleParser parser(data);
+    BinaryWriter writer(out, BinaryKind::PUZZLES);
+    while (auto puzzle = parser.next()) {
+      writer.add(puzzle.value());
+      ++records;
+    }
+    writer.finish();
+  }
+  if (!options.quiet) {
+    std::cout << "converted " << records << " records to "
+              << options.convert_file << std::endl;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  auto options = parse_options(argc, argv);
+
+  std::optional<LineCache> cache;
+  if (options.solver.m_line_cache_capacity > 0) {
+    cache.emplace(options.solver.m_line_cache_capacity);
+  }
+  auto *cache_ptr = cache ? &cache.value() : nullptr;
+
+  try {
+    if (!options.serve.empty()) {
+      return run_serve(options);
+    }
+    if (options.parse_only) {
+      return run_parse(options);
+    }
+    if (!options.convert_file.empty()) {
+      return run_convert(options);
+    }
+    if (options.batch && options.input_file == "-") {
+      int line_no = 1;
+      return run_batch(
+          options, [&] { return read_next_puzzle(std::cin, &line_no); },
+          cache_ptr);
+    }
+    auto parse_begin = std::chrono::steady_clock::now();
+    PuzzleFile input(options.input_file);
+    if (options.batch) {
+      return run_batch(options, [&] { return input.next(); }, cache_ptr);
+    }
+    auto puzzle = input.next();
+    if (!puzzle.has_value()) {
+      throw ParseError(input.m_parser.m_line, "no puzzle in input");
+    }
+    return run_solve(options, puzzle.value(), cache_ptr,
+                     {.parse_ns = nanoseconds_since(parse_begin)});
+  } catch (const ParseError &e) {
+    std::cerr << options.input_file << ": " << e.what() << std::endl;
+  } catch (const BinaryFormatError &e) {
+    std::cerr << options.input_file << ": " << e.what() << std::endl;
+  } catch (const std::system_error &e) {
+    std::cerr << e.what() << std::endl;
+  }
+  return 1;
+}
@@ -1,8 +1,20 @@
 #include "nonogram.hpp"
+#include "learning.hpp"
+#include "line_cache.hpp"
+#include "placement_table.hpp"
+#include "puzzle_parser.hpp"
+#include "short_line.hpp"
+#include "thread_pool.hpp"
 
 #include <optional>
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <numeric>
 #include <ranges>
 #include <sstream>
 #include <string>
@@ -38,6 +50,57 @@ Puzzle read_puzzle(std::istream &is) {
   return puzzle;
 }
 
+namespace {
+
+void read_next_rules(std::istream &is, std::vector<RulesLine> &rules,
+                     int line_size, int &line_no) {
+  std::string line;
+  for (auto &rule : rules) {
+    if (!std::getline(is, line)) {
+      throw ParseError(line_no, "unexpected end of input, expected " +
+                                    std::to_string(rules.size()) +
+                                    " lines of rules");
+    }
+    parse_rules_line(line, line_no++, line_size, rule);
+  }
+}
+
+} // namespace
+
+std::optional<Puzzle> read_next_puzzle(std::istream &is, int *line_no) {
+  int line_count = 1;
+  if (line_no == nullptr) {
+    line_no = &line_count;
+  }
+  std::string header;
+  while (std::getline(is, header)) {
+    auto sides = parse_header(header, (*line_no)++);
+    if (!sides.has_value()) {
+      // blank separator line
+      continue;
+    }
+    auto [width, height] = *sides;
+    Puzzle puzzle(width, height);
+    read_next_rules(is, puzzle.m_vertical_rules, height, *line_no);
+    read_next_rules(is, puzzle.m_horizontal_rules, width, *line_no);
+    return puzzle;
+  }
+  return std::nullopt;
+}
+
+void write_puzzle(std::ostream &os, const Puzzle &puzzle) {
+  os << puzzle.m_width << " " << puzzle.m_height << "\n";
+  for (const auto *rules :
+       {&puzzle.m_vertical_rules, &puzzle.m_horizontal_rules}) {
+    for (const auto &rule : *rules) {
+      for (int k = 0; k < rule.size(); ++k) {
+        os << (k > 0 ? " " : "") << rule[k];
+      }
+      os << "\n";
+    }
+  }
+}
+
 void print_rules(std::ostream &os, const std::vector<std::vector<int>> &rules) {
   int sum = 0;
   os << "[" << std::endl;
@@ -99,69 +162,276 @@ std::vector<int> make_rfit_from_rules(const int line_size,
   return fit;
 }
 
-SolutionLine::SolutionLine(int size, const RulesLine &rules)
-    : m_rules(rules), m_cells(size, Cell::UNKNOWN), m_solved_flg(false),
-      m_lfit(rules.size()), m_rfit(rules.size()), m_lfit_reversed(rules.size()),
+LineState::LineState(int size, const RulesLine &rules)
+    : m_rules(rules), m_size(size), m_solved_flg(false), m_lfit(rules.size()),
+      m_rfit(rules.size()), m_lfit_reversed(rules.size()),
       m_rfit_reversed(rules.size()) {
 
   update_fits(make_lfit_from_rules(rules), make_rfit_from_rules(size, rules));
 }
 
-void SolutionLine::update_fits(std::vector<int> &&lfit,
+void LineState::update_fits(std::vector<int> &&lfit,
                                std::vector<int> &&rfit) {
-  m_lfit = std::move(lfit);
-  m_rfit = std::move(rfit);
+  assign_fits(lfit, rfit);
+}
+
+void LineState::assign_fits(std::span<const int> lfit,
+                               std::span<const int> rfit) {
+  m_lfit.assign(lfit.begin(), lfit.end());
+  m_rfit.assign(rfit.begin(), rfit.end());
   m_lfit_reversed = m_rfit;
   reverse_fit(size(), m_rules, m_lfit_reversed);
   m_rfit_reversed = m_lfit;
   reverse_fit(size(), m_rules, m_rfit_reversed);
 }
 
-const size_t SolutionLine::size() const { return m_cells.size(); }
+const size_t LineState::size() const { return m_size; }
+
+SolutionLine::SolutionLine(int size, const RulesLine &rules)
+    : LineState(size, rules), m_cells(size, Cell::UNKNOWN) {}
+
+LineQueue::LineQueue(int n_lines, PropagationOrder order)
+    : m_order(order), m_queued(n_lines, false), m_live_sequence(n_lines, 0) {}
+
+void LineQueue::push(int line, int priority) {
+  if (m_queued[line]) {
+    ++m_coalesced;
+    if (m_order != PropagationOrder::NEWLY_FIXED) {
+      // priority did not change
+      return;
+    }
+  }
+  m_queued[line] = true;
+  m_live_sequence[line] = m_sequence;
+  m_heap.push({.m_priority = priority, .m_sequence = m_sequence, .m_line = line});
+  ++m_sequence;
+}
+
+std::optional<int> LineQueue::pop() {
+  while (!m_heap.empty()) {
+    auto entry = m_heap.top();
+    m_heap.pop();
+    if (m_queued[entry.m_line] &&
+        m_live_sequence[entry.m_line] == entry.m_sequence) {
+      m_queued[entry.m_line] = false;
+      return entry.m_line;
+    }
+  }
+  return std::nullopt;
+}
 
 Solution::Solution(int width, int height,
                    const std::vector<RulesLine> &vertical_rules,
-                   const std::vector<RulesLine> &horizontal_rules)
-    : m_width(width), m_height(height), m_is_final(false) {
+                   const std::vector<RulesLine> &horizontal_rules,
+                   PropagationOrder order)
+    : m_width(width), m_height(height), m_is_final(false),
+      m_grid(width, height), m_line_changes(width + height, 1),
+      m_queue(width + height, order) {
   for (int i = 0; i < m_height; ++i) {
     m_rows_.emplace_back(width, horizontal_rules[i]);
   }
   for (int i = 0; i < m_width; ++i) {
     m_columns_.emplace_back(height, vertical_rules[i]);
   }
+  if (order != PropagationOrder::SWEEP) {
+    for (int j = 0; j < m_width; ++j) {
+      m_queue.push(column_line(j), line_priority(column_line(j)));
+    }
+    for (int i = 0; i < m_height; ++i) {
+      m_queue.push(row_line(i), line_priority(row_line(i)));
+    }
+  }
 }
 
-const Cell Solution::get_cell(int i, int j) const {
-  return m_rows_[i].m_cells[j];
+const Cell Solution::get_cell(int i, int j) const { return m_grid.get(i, j); }
+
+void Solution::set_cell(int i, int j, Cell value, int reason) {
+  if (get_cell(i, j) == value) {
+    return;
+  }
+  record_cell(i, j, reason);
+  m_grid.set(i, j, value);
+  mark_line_changed(row_line(i));
+  mark_line_changed(column_line(j));
 }
-void Solution::set_cell(int i, int j, Cell value) {
-  m_rows_[i].m_cells[j] = value;
-  m_columns_[j].m_cells[i] = value;
+
+int Solution::set_row(int i, const UpdateResult &update) {
+  int changed = 0;
+  for (int j = 0; j < update.m_cells.size(); ++j) {
+    if (get_cell(i, j) != update.m_cells[j]) {
+      record_cell(i, j, row_line(i));
+      m_grid.set_in_row(i, j, update.m_cells[j]);
+      mark_line_changed(column_line(j));
+      ++changed;
+    }
+  }
+  record_fits(row_line(i));
+  m_rows_[i].assign_fits(*update.m_lfit, *update.m_rfit);
+  m_line_changes[row_line(i)] = 0;
+  return changed;
 }
 
-void Solution::set_row(int i, const CellsLine &line, std::vector<int> &&lfit,
-                       std::vector<int> &&rfit) {
-  for (int j = 0; j < line.size(); ++j) {
-    set_cell(i, j, line[j]);
+int Solution::set_column(int j, const UpdateResult &update) {
+  int changed = 0;
+  for (int i = 0; i < update.m_cells.size(); ++i) {
+    if (get_cell(i, j) != update.m_cells[i]) {
+      record_cell(i, j, column_line(j));
+      m_grid.set_in_column(i, j, update.m_cells[i]);
+      mark_line_changed(row_line(i));
+      ++changed;
+    }
   }
-  m_rows_[i].update_fits(std::move(lfit), std::move(rfit));
+  record_fits(column_line(j));
+  m_columns_[j].assign_fits(*update.m_lfit, *update.m_rfit);
+  m_line_changes[column_line(j)] = 0;
+  return changed;
 }
 
-void Solution::set_column(int j, const CellsLine &line, std::vector<int> &&lfit,
-                          std::vector<int> &&rfit) {
-  for (int i = 0; i < line.size(); ++i) {
-    set_cell(i, j, line[i]);
+const LineState &Solution::get_line(int line) const {
+  return line < m_height ? m_rows_[line] : m_columns_[line - m_height];
+}
+
+void Solution::sync_line(int line) {
+  if (line < m_height) {
+    m_grid.sync_row(line);
+  } else {
+    m_grid.sync_column(line - m_height);
+  }
+}
+
+void Solution::load_line(int line, PackedLine &cells) const {
+  if (line < m_height) {
+    m_grid.load_row(line, cells);
+  } else {
+    m_grid.load_column(line - m_height, cells);
+  }
+}
+
+CellsLine Solution::line_cells(int line) const {
+  CellsLine cells(get_line(line).size());
+  for (int k = 0; k < cells.size(); ++k) {
+    cells[k] = line < m_height ? get_cell(line, k)
+                               : get_cell(k, line - m_height);
   }
-  m_columns_[j].update_fits(std::move(lfit), std::move(rfit));
+  return cells;
 }
 
-const SolutionLine &Solution::get_row(int i) const { return m_rows_[i]; }
+void Solution::record_cell(int i, int j, int reason) {
+  if (m_recording) {
+    m_trail.m_entries.push_back({.m_kind = Trail::Entry::Kind::CELL,
+                                 .m_a = i,
+                                 .m_b = j,
+                                 .m_old_cell = get_cell(i, j),
+                                 .m_reason = reason});
+  }
+}
 
-const SolutionLine &Solution::get_column(int j) const { return m_columns_[j]; }
+int Solution::line_priority(int line) const {
+  switch (m_queue.m_order) {
+  case PropagationOrder::NEWLY_FIXED:
+    return m_line_changes[line];
+  case PropagationOrder::SLACK: {
+    const auto &solution_line = get_line(line);
+    int slack = 0;
+    for (int r = 0; r < solution_line.m_lfit.size(); ++r) {
+      slack += solution_line.m_rfit[r] - solution_line.m_lfit[r];
+    }
+    return -slack;
+  }
+  default:
+    return 0;
+  }
+}
 
-void Solution::mark_row_solved(int i) { m_rows_[i].m_solved_flg = true; }
+void Solution::mark_line_changed(int line) {
+  ++m_line_changes[line];
+  if (m_queue.m_order == PropagationOrder::SWEEP ||
+      get_line(line).m_solved_flg) {
+    return;
+  }
+  m_queue.push(line, line_priority(line));
+}
+
+const LineState &Solution::get_row(int i) const { return m_rows_[i]; }
+
+const LineState &Solution::get_column(int j) const { return m_columns_[j]; }
 
-void Solution::mark_column_solved(int j) { m_columns_[j].m_solved_flg = true; }
+void Solution::mark_row_solved(int i) {
+  record_solved(row_line(i));
+  m_rows_[i].m_solved_flg = true;
+}
+
+void Solution::mark_column_solved(int j) {
+  record_solved(column_line(j));
+  m_columns_[j].m_solved_flg = true;
+}
+
+LineState &Solution::line_at(int line) {
+  return line < m_height ? m_rows_[line] : m_columns_[line - m_height];
+}
+
+void Solution::record_fits(int line) {
+  if (!m_recording) {
+    return;
+  }
+  const auto &solution_line = get_line(line);
+  m_trail.m_entries.push_back({.m_kind = Trail::Entry::Kind::FITS,
+                               .m_a = line,
+                               .m_b = static_cast<int>(m_trail.m_fits.size())});
+  m_trail.m_fits.insert(m_trail.m_fits.end(), solution_line.m_lfit.begin(),
+                        solution_line.m_lfit.end());
+  m_trail.m_fits.insert(m_trail.m_fits.end(), solution_line.m_rfit.begin(),
+                        solution_line.m_rfit.end());
+}
+
+void Solution::record_solved(int line) {
+  if (m_recording && !get_line(line).m_solved_flg) {
+    m_trail.m_entries.push_back(
+        {.m_kind = Trail::Entry::Kind::SOLVED, .m_a = line});
+  }
+}
+
+void Solution::start_recording() { m_recording = true; }
+
+void Solution::stop_recording() {
+  m_recording = false;
+  m_trail.m_entries.clear();
+  m_trail.m_undone_to = 0;
+  m_trail.m_fits.clear();
+}
+
+void Solution::undo_to(size_t mark) {
+  assert(mark <= m_trail.mark());
+  m_trail.m_undone_to = std::min(m_trail.m_undone_to, mark);
+  bool recording = m_recording;
+  m_recording = false;
+  while (m_trail.mark() > mark) {
+    auto entry = m_trail.m_entries.back();
+    m_trail.m_entries.pop_back();
+    switch (entry.m_kind) {
+    case Trail::Entry::Kind::CELL:
+      m_grid.set(entry.m_a, entry.m_b, entry.m_old_cell);
+      m_line_changes[row_line(entry.m_a)] = 0;
+      m_line_changes[column_line(entry.m_b)] = 0;
+      break;
+    case Trail::Entry::Kind::FITS: {
+      auto &solution_line = line_at(entry.m_a);
+      auto n_rules = solution_line.m_rules.size();
+      std::span<const int> fits(m_trail.m_fits.begin() + entry.m_b,
+                                2 * n_rules);
+      solution_line.assign_fits(fits.first(n_rules), fits.last(n_rules));
+      m_trail.m_fits.resize(entry.m_b);
+      break;
+    }
+    case Trail::Entry::Kind::SOLVED:
+      line_at(entry.m_a).m_solved_flg = false;
+      break;
+    }
+  }
+  while (m_queue.pop()) {
+  }
+  m_recording = recording;
+}
 
 const bool Solution::is_row_solved(int i) const {
   return m_rows_[i].m_solved_flg;
@@ -183,8 +453,9 @@ char print_cell(Cell c) {
 }
 
 void print_solution(std::ostream &os, const Solution &solution) {
-  for (const auto &row : solution.m_rows_) {
-    for (auto v : row.m_cells) {
+  for (int i = 0; i < solution.m_height; ++i) {
+    for (int j = 0; j < solution.m_width; ++j) {
+      auto v = solution.get_cell(i, j);
       os << print_cell(v)
          << print_cell(v); // print twice for better proportions
     }
@@ -199,130 +470,213 @@ bool range_has_filled_cells(CellsRange &&cells) {
          std::ranges::end(cells);
 }
 
-template <typename CellsRange>
-  requires array_like_range_for_value<CellsRange, Cell>
-bool range_has_empty_cells(CellsRange &&cells) {
-  return std::ranges::find(std::forward<CellsRange>(cells), Cell::EMPTY) !=
-         std::ranges::end(cells);
-}
-
+// Flat DP table for the line fitter. For rule r and x in its window
+// [lfit[r], rfit[r]], best(r, x) is the rightmost position i <= x at which
+// rule r can be placed with all of the following rules still fitting, or
+// kCannotFit if there is none.
 struct FitDpTable {
-  struct DpValue {
-    bool can_fit;
-    int index;
-  };
+  static constexpr std::int32_t kCannotFit = -1;
 
-  using DpValueOpt = std::optional<DpValue>;
-  using DpRow = std::vector<DpValueOpt>;
-  using DpTable = std::vector<DpRow>;
-
-  FitDpTable(int n_rules, int n_cells)
-      : values(n_rules + 1, DpRow(n_cells + 1, std::nullopt)) {}
+  void reserve(int n_rules, int n_cells) {
+    m_offsets.reserve(n_rules + 1);
+    m_best.reserve(static_cast<size_t>(n_rules) * n_cells);
+    m_next_filled.reserve(n_cells + 1);
+  }
 
-  DpTable values;
-};
+  template <typename FitRange>
+  void reset(const FitRange &lfit, const FitRange &rfit,
+             const PackedLineIndex &cells) {
+    m_lfit = lfit.data();
+    m_rfit = rfit.data();
+    m_offsets.resize(lfit.size() + 1);
+    m_offsets[0] = 0;
+    for (int r = 0; r < lfit.size(); ++r) {
+      m_offsets[r + 1] = m_offsets[r] + std::max(0, rfit[r] - lfit[r] + 1);
+    }
+    m_best.resize(m_offsets.back());
 
-// Right fit rules {rule_i, rule_{i+1}, ..., rule_{N-1}} into cells {cell_i,
-// cell_{i+1}, ..., cell_{M-1}}
-template <typename RulesRange, typename CellsRange, typename FitRange>
-  requires array_like_range_for_value<RulesRange, Rule> &&
-           array_like_range_for_value<CellsRange, Cell> &&
-           array_like_range_for_value<FitRange, int>
-void fit_dp_iter(FitDpTable &table, const RulesRange &rules,
-                 const CellsRange &cells, const FitRange &lfit,
-                 const FitRange &rfit, int rule_i, int cell_i) {
-  auto &table_value = table.values[rule_i][cell_i];
-  assert(!table_value.has_value());
-
-  if (rule_i == rules.size()) {
-    table_value = {
-        .can_fit = !range_has_filled_cells(cells | std::views::drop(cell_i)),
-        .index = -1}; // index does not matter
-    return;
+    const int n_cells = cells.size();
+    m_next_filled.resize(n_cells + 1);
+    m_next_filled[n_cells] = n_cells;
+    for (int c = n_cells - 1; c >= 0; --c) {
+      m_next_filled[c] = cells.is_filled(c) ? c : m_next_filled[c + 1];
+    }
   }
 
-  if (cell_i > rfit[rule_i]) {
-    // not enough space for this block
-    table_value = {.can_fit = false};
-    return;
+  std::int32_t &best(int rule_i, int x) {
+    return m_best[m_offsets[rule_i] + x - m_lfit[rule_i]];
   }
-
-  auto lower_bound = std::max(cell_i, lfit[rule_i]);
-  if (range_has_filled_cells(cells | std::views::take(lower_bound) |
-                             std::views::drop(cell_i))) {
-    // got filled cells that cannot be covered
-    table_value = {.can_fit = false};
-    return;
+  std::int32_t best(int rule_i, int x) const {
+    return m_best[m_offsets[rule_i] + x - m_lfit[rule_i]];
   }
 
-  auto current_rule = rules[rule_i];
-  auto next_rule_i = rule_i + 1;
-  auto is_last_rule = rule_i == rules.size() - 1;
-  auto next_cell_i = rfit[rule_i] + current_rule + (is_last_rule ? 0 : 1);
-  assert(next_cell_i <= cells.size());
-  assert(next_rule_i <= rules.size());
-  for (int i = rfit[rule_i]; i >= lower_bound; --i, --next_cell_i) {
-    assert(cells.size() - i >= current_rule);
-    if (range_has_filled_cells(cells | std::views::take(i) |
-                               std::views::drop(cell_i))) {
-      // uncovered filled cells remaining before block
-      continue;
+  // Rightmost position of rule_i when rules {rule_i, ..., rule_{N-1}} are
+  // fitted into cells {cell_i, ..., cell_{M-1}}, or kCannotFit
+  std::int32_t place(int rule_i, int cell_i) const {
+    if (cell_i > m_rfit[rule_i]) {
+      // not enough space for this block
+      return kCannotFit;
     }
-    if (range_has_empty_cells(cells | std::views::drop(i) |
-                              std::views::take(current_rule))) {
-      // block covers empty cell
-      continue;
-    }
-    if (i + current_rule < cells.size() &&
-        cells[i + current_rule] == Cell::FILLED) {
-      // block is next to a filled cell
-      continue;
+    auto lower_bound = std::max(cell_i, m_lfit[rule_i]);
+    // the block cannot start past the first filled cell
+    auto upper_bound = std::min(m_rfit[rule_i], m_next_filled[cell_i]);
+    if (upper_bound < lower_bound) {
+      return kCannotFit;
     }
+    auto index = best(rule_i, upper_bound);
+    return index >= lower_bound ? index : kCannotFit;
+  }
+
+  const int *m_lfit{nullptr};
+  const int *m_rfit{nullptr};
+  std::vector<int> m_offsets;
+  std::vector<std::int32_t> m_best;
+  std::vector<int> m_next_filled;
+};
 
-    // block fits, trying to satisfy remaining rules
-    auto &next_dp_value = table.values[next_rule_i][next_cell_i];
-    if (!next_dp_value.has_value()) {
-      fit_dp_iter(table, rules, cells, lfit, rfit, next_rule_i, next_cell_i);
+// Per-thread storage reused by every line solve, so that propagation does not
+// touch the heap once the buffers have grown to the largest line
+struct LineScratch {
+  FitDpTable m_table;
+  // the line being solved, and a reversed copy of it
+  PackedLine m_line;
+  PackedLine m_cells;
+  PackedLineIndex m_index;
+  UpdateResult m_update;
+  ProbeScratch m_probe;
+};
+
+LineScratch &line_scratch() {
+  thread_local LineScratch scratch;
+  return scratch;
+}
+
+ProbeScratch &probe_scratch() { return line_scratch().m_probe; }
+
+std::vector<int> &reset_fit(std::optional<std::vector<int>> &fit) {
+  if (!fit.has_value()) {
+    fit.emplace();
+  }
+  fit->clear();
+  return *fit;
+}
+
+void reserve_line_scratch(const Puzzle &puzzle, const SolverOptions &options) {
+  int max_cells = std::max(puzzle.m_width, puzzle.m_height);
+  size_t max_rules = 0;
+  for (const auto *rules : {&puzzle.m_vertical_rules,
+                            &puzzle.m_horizontal_rules}) {
+    for (const auto &line_rules : *rules) {
+      max_rules = std::max(max_rules, line_rules.size());
     }
-    assert(next_dp_value.has_value());
+  }
 
-    if (next_dp_value->can_fit) {
-      table_value = {.can_fit = true, .index = i};
-      return;
+  auto &scratch = line_scratch();
+  scratch.m_table.reserve(max_rules, max_cells);
+  scratch.m_line.assign(std::vector<Cell>(max_cells).data(), max_cells);
+  scratch.m_cells.assign_reversed(scratch.m_line);
+  scratch.m_index.build(scratch.m_cells);
+  scratch.m_update.m_cells.reserve(max_cells);
+  reset_fit(scratch.m_update.m_lfit).reserve(max_rules);
+  reset_fit(scratch.m_update.m_rfit).reserve(max_rules);
+  if (options.m_probe_budget > 0) {
+    // never shrinks, so every entry past the grid stays UNKNOWN too
+    auto &values = scratch.m_probe.m_filled_values;
+    size_t cells = size_t{1} * puzzle.m_width * puzzle.m_height;
+    values.resize(std::max(values.size(), cells), Cell::UNKNOWN);
+  }
+}
+
+// Right fit rules into cells, filling the table bottom-up from the last rule
+// so that no recursion is needed however long the line is. Returns whether
+// the rules fit.
+template <typename RulesRange, typename FitRange>
+  requires array_like_range_for_value<RulesRange, Rule> &&
+           array_like_range_for_value<FitRange, int>
+bool fit_dp(FitDpTable &table, const RulesRange &rules,
+            const PackedLineIndex &cells, const FitRange &lfit,
+            const FitRange &rfit) {
+  const int n_rules = rules.size();
+  const int n_cells = cells.size();
+  table.reset(lfit, rfit, cells);
+
+  for (int rule_i = n_rules - 1; rule_i >= 0; --rule_i) {
+    auto current_rule = rules[rule_i];
+    auto is_last_rule = rule_i == n_rules - 1;
+    auto prev_best = FitDpTable::kCannotFit;
+    for (int i = lfit[rule_i]; i <= rfit[rule_i]; ++i) {
+      assert(n_cells - i >= current_rule);
+      auto next_cell_i = i + current_rule + (is_last_rule ? 0 : 1);
+      bool fits =
+          // block does not cover empty cells
+          !cells.has_empty(i, i + current_rule) &&
+          // block is not next to a filled cell
+          !(i + current_rule < n_cells && cells.is_filled(i + current_rule)) &&
+          // remaining rules fit after the block
+          (is_last_rule ? !cells.has_filled(next_cell_i, n_cells)
+                        : table.place(rule_i + 1, next_cell_i) !=
+                              FitDpTable::kCannotFit);
+      if (fits) {
+        prev_best = i;
+      }
+      table.best(rule_i, i) = prev_best;
     }
   }
 
-  table_value = {.can_fit = false};
-  return;
+  if (n_rules == 0) {
+    return !cells.has_filled(0, n_cells);
+  }
+  return table.place(0, 0) != FitDpTable::kCannotFit;
 }
 
 template <typename RulesRange>
   requires array_like_range_for_value<RulesRange, Rule>
-std::vector<int> fit_dp_construct(const FitDpTable &table,
-                                  const RulesRange &rules) {
-  std::vector<int> fit;
-  int rule_i = 0;
+void fit_dp_construct(const FitDpTable &table, const RulesRange &rules,
+                      std::vector<int> &fit) {
+  fit.clear();
   int cell_i = 0;
-  while (rule_i < rules.size()) {
-    const auto &dp_value = table.values[rule_i][cell_i];
-    assert(dp_value.has_value() && dp_value->can_fit);
-    fit.push_back(dp_value->index);
-    cell_i = dp_value->index + rules[rule_i] + 1;
-    ++rule_i;
+  for (int rule_i = 0; rule_i < rules.size(); ++rule_i) {
+    auto index = table.place(rule_i, cell_i);
+    assert(index != FitDpTable::kCannotFit);
+    fit.push_back(index);
+    cell_i = index + rules[rule_i] + 1;
   }
-  return fit;
+}
+
+bool fit_left(const RulesLine &rules, const LineState &line,
+              const PackedLine &cells, LineScratch &scratch,
+              std::vector<int> &fit) {
+  scratch.m_cells.assign_reversed(cells);
+  scratch.m_index.build(scratch.m_cells);
+  auto rules_reversed = rules | std::views::reverse;
+  if (!fit_dp(scratch.m_table, rules_reversed, scratch.m_index,
+              line.m_lfit_reversed, line.m_rfit_reversed)) {
+    return false;
+  }
+  fit_dp_construct(scratch.m_table, rules_reversed, fit);
+  reverse_fit(line.size(), rules_reversed, fit);
+  return true;
+}
+
+// Every placement starts each rule between lfit and rfit, which bound the
+// DP table
+bool fit_right(const RulesLine &rules, std::span<const int> lfit,
+               std::span<const int> rfit, const PackedLine &cells,
+               LineScratch &scratch, std::vector<int> &fit) {
+  scratch.m_index.build(cells);
+  if (!fit_dp(scratch.m_table, rules, scratch.m_index, lfit, rfit)) {
+    return false;
+  }
+  fit_dp_construct(scratch.m_table, rules, fit);
+  return true;
 }
 
 std::optional<std::vector<int>> fit_left(const RulesLine &rules,
                                          const SolutionLine &line) {
-  FitDpTable table(rules.size(), line.size());
-  auto rules_reversed = rules | std::views::reverse;
-  fit_dp_iter(table, rules_reversed, line.m_cells | std::views::reverse,
-              line.m_lfit_reversed, line.m_rfit_reversed, 0, 0);
-  assert(table.values[0][0].has_value());
-  if (table.values[0][0]->can_fit) {
-    auto fit = fit_dp_construct(table, rules_reversed);
-    reverse_fit(line.size(), rules_reversed, fit);
+  auto &scratch = line_scratch();
+  scratch.m_line.assign(line.m_cells.data(), line.size());
+  std::vector<int> fit;
+  if (fit_left(rules, line, scratch.m_line, scratch, fit)) {
     return fit;
   }
   return std::nullopt;
@@ -330,21 +684,23 @@ std::optional<std::vector<int>> fit_left(const RulesLine &rules,
 
 std::optional<std::vector<int>> fit_right(const RulesLine &rules,
                                           const SolutionLine &line) {
-  FitDpTable table(rules.size(), line.size());
-  fit_dp_iter(table, rules, line.m_cells, line.m_lfit, line.m_rfit, 0, 0);
-  assert(table.values[0][0].has_value());
-  if (table.values[0][0]->can_fit) {
-    return fit_dp_construct(table, rules);
+  auto &scratch = line_scratch();
+  scratch.m_line.assign(line.m_cells.data(), line.size());
+  std::vector<int> fit;
+  if (fit_right(rules, line.m_lfit, line.m_rfit, scratch.m_line, scratch,
+                fit)) {
+    return fit;
   }
   return std::nullopt;
 }
 
-UpdateResult update_cells_from_empty_rules(CellsLine &&line) {
+void update_cells_from_empty_rules(UpdateResult &result) {
+  auto &line = result.m_cells;
   if (range_has_filled_cells(line)) {
-    return {.m_rules_fit = false,
-            .m_line_updated = false,
-            .m_line_solved = false,
-            .m_cells = std::move(line)};
+    result.m_rules_fit = false;
+    result.m_line_updated = false;
+    result.m_line_solved = false;
+    return;
   }
 
   bool line_updated = false;
@@ -354,18 +710,18 @@ UpdateResult update_cells_from_empty_rules(CellsLine &&line) {
       line_updated = true;
     }
   }
-  return {.m_rules_fit = true,
-          .m_line_updated = line_updated,
-          .m_line_solved = true,
-          .m_cells = std::move(line),
-          .m_lfit = std::vector<int>(),
-          .m_rfit = std::vector<int>()};
+  result.m_rules_fit = true;
+  result.m_line_updated = line_updated;
+  result.m_line_solved = true;
+  reset_fit(result.m_lfit);
+  reset_fit(result.m_rfit);
 }
 
-UpdateResult update_cells_from_lfit_and_rfit(const RulesLine &rules,
-                                             CellsLine &&line,
-                                             std::vector<int> &&lfit,
-                                             std::vector<int> &&rfit) {
+void update_cells_from_lfit_and_rfit(const RulesLine &rules,
+                                     UpdateResult &result) {
+  auto &line = result.m_cells;
+  const auto &lfit = *result.m_lfit;
+  const auto &rfit = *result.m_rfit;
   int rule_i = 0;
   int intersect_left = rfit[0];
   int intersect_right = lfit[0] + rules[0];
@@ -408,100 +764,647 @@ UpdateResult update_cells_from_lfit_and_rfit(const RulesLine &rules,
     }
   }
 
-  return {.m_rules_fit = rule_i == rules.size(),
-          .m_line_updated = line_updated,
-          .m_line_solved = line_solved,
-          .m_cells = std::move(line),
-          .m_lfit = std::move(lfit),
-          .m_rfit = std::move(rfit)};
+  result.m_rules_fit = rule_i == rules.size();
+  result.m_line_updated = line_updated;
+  result.m_line_solved = line_solved;
 }
 
-UpdateResult update_cells(const RulesLine &rules, const SolutionLine &line) {
-  auto cells = line.m_cells;
+// Whether the blocks of rules placed at fit cover no empty cell and leave no
+// filled cell uncovered
+bool fit_is_consistent(const RulesLine &rules, std::span<const int> fit,
+                       const PackedLine &cells) {
+  int covered_to = 0;
+  for (int r = 0; r < rules.size(); ++r) {
+    if (fit[r] < covered_to || fit[r] + rules[r] > cells.size() ||
+        cells.has_filled(covered_to, fit[r]) ||
+        cells.has_empty(fit[r], fit[r] + rules[r])) {
+      return false;
+    }
+    covered_to = fit[r] + rules[r];
+    if (covered_to < cells.size() &&
+        cells.has_filled(covered_to, covered_to + 1)) {
+      return false;
+    }
+    ++covered_to;
+  }
+  return !cells.has_filled(covered_to, cells.size());
+}
+
+// Solves the line of cells with the given state and rules into result, from
+// the placement table of the line if given
+void update_packed_line(const RulesLine &rules, const LineState &line,
+                        const PackedLine &cells, LineScratch &scratch,
+                        UpdateResult &result, const PlacementTable *table) {
+  result.m_fits_computed = 0;
+  result.m_fits_reused = 0;
+  if (table != nullptr && !rules.empty()) {
+    table->update(cells, result);
+    return;
+  }
+  if (!rules.empty() && cells.size() <= kShortLineCells) {
+    update_short_line(rules, cells, result);
+    return;
+  }
+  result.m_cells.resize(cells.size());
+  for (int k = 0; k < cells.size(); ++k) {
+    result.m_cells[k] = cells.get(k);
+  }
+  result.m_dp_states = 0;
   if (rules.empty()) {
-    return update_cells_from_empty_rules(std::move(cells));
+    update_cells_from_empty_rules(result);
+    return;
   }
 
-  auto lfit_opt = fit_left(rules, line);
-  if (!lfit_opt.has_value()) {
-    return {
-        .m_rules_fit = false, .m_line_updated = false, .m_line_solved = false};
+  // Cells fixed since the last solve only rule placements out, so a previous
+  // fit that the cells still allow is still the leftmost or rightmost one.
+  // Late in propagation most changes fall between the fits.
+  if (fit_is_consistent(rules, line.m_lfit, cells)) {
+    reset_fit(result.m_lfit).assign(line.m_lfit.begin(), line.m_lfit.end());
+    ++result.m_fits_reused;
+  } else {
+    bool lfit_found =
+        fit_left(rules, line, cells, scratch, reset_fit(result.m_lfit));
+    result.m_dp_states += scratch.m_table.m_best.size();
+    ++result.m_fits_computed;
+    if (!lfit_found) {
+      result.m_rules_fit = false;
+      result.m_line_updated = false;
+      result.m_line_solved = false;
+      return;
+    }
+  }
+  if (fit_is_consistent(rules, line.m_rfit, cells)) {
+    reset_fit(result.m_rfit).assign(line.m_rfit.begin(), line.m_rfit.end());
+    ++result.m_fits_reused;
+  } else {
+    // no placement starts a rule before the new left fit
+    [[maybe_unused]] bool rules_fit =
+        fit_right(rules, *result.m_lfit, line.m_rfit, cells, scratch,
+                  reset_fit(result.m_rfit));
+    assert(rules_fit);
+    result.m_dp_states += scratch.m_table.m_best.size();
+    ++result.m_fits_computed;
   }
-  auto rfit_opt = fit_right(rules, line);
-  assert(rfit_opt.has_value());
 
-  return update_cells_from_lfit_and_rfit(rules, std::move(cells),
-                                         std::move(lfit_opt.value()),
-                                         std::move(rfit_opt.value()));
+  update_cells_from_lfit_and_rfit(rules, result);
 }
 
-Solution solve_iter(const Puzzle &puzzle, Solution &solution) {
+void update_cells(const RulesLine &rules, const SolutionLine &line,
+                  UpdateResult &result, const PlacementTable *table) {
+  auto &scratch = line_scratch();
+  scratch.m_line.assign(line.m_cells.data(), line.size());
+  update_packed_line(rules, line, scratch.m_line, scratch, result, table);
+}
+
+void update_cells(const LineState &line, const PackedLine &cells,
+                  UpdateResult &result) {
+  update_packed_line(line.m_rules, line, cells, line_scratch(), result,
+                     nullptr);
+}
+
+UpdateResult update_cells(const RulesLine &rules, const SolutionLine &line) {
+  UpdateResult result;
+  update_cells(rules, line, result);
+  if (!result.m_rules_fit) {
+    result.m_lfit.reset();
+    result.m_rfit.reset();
+  }
+  return result;
+}
+
+// Solves a synced line into update_result. Returns false if the result came
+// from the cache instead of update_cells.
+bool update_line(const Puzzle &puzzle, const Solution &solution, int line,
+                 UpdateResult &update_result, const SolverContext &context) {
+  const auto &rules =
+      line < solution.m_height
+          ? puzzle.m_horizontal_rules[line]
+          : puzzle.m_vertical_rules[line - solution.m_height];
+  auto &scratch = line_scratch();
+  solution.load_line(line, scratch.m_line);
+  auto cache = context.m_cache;
+  if (cache != nullptr &&
+      cache->lookup(rules, scratch.m_line, update_result)) {
+    return false;
+  }
+  update_packed_line(rules, solution.get_line(line), scratch.m_line, scratch,
+                     update_result,
+                     context.m_line_tables.empty()
+                         ? nullptr
+                         : context.m_line_tables[line]);
+  if (cache != nullptr) {
+    cache->insert(rules, scratch.m_line, update_result);
+  }
+  return true;
+}
+
+// Writes back the result of update_line and counts it. Returns false if the
+// line cannot fit its rules.
+bool apply_line_update(Solution &solution, int line,
+                       const UpdateResult &update_result, bool computed,
+                       SolverStats &stats) {
+  ++stats.m_line_solves;
+  bool is_row = line < solution.m_height;
+  if (computed) {
+    ++(is_row ? stats.m_row_updates : stats.m_column_updates);
+    stats.m_dp_states += update_result.m_dp_states;
+    stats.m_fits_computed += update_result.m_fits_computed;
+    stats.m_fits_reused += update_result.m_fits_reused;
+  }
+  if (!update_result.m_rules_fit) {
+    solution.m_conflict = line;
+    return false;
+  }
+  if (is_row) {
+    if (update_result.m_line_solved) {
+      solution.mark_row_solved(line);
+    }
+    stats.m_propagation_fixed_cells += solution.set_row(line, update_result);
+  } else {
+    auto j = line - solution.m_height;
+    if (update_result.m_line_solved) {
+      solution.mark_column_solved(j);
+    }
+    stats.m_propagation_fixed_cells += solution.set_column(j, update_result);
+  }
+  return true;
+}
+
+// Solves a single row or column. Returns false if it cannot fit its rules.
+bool propagate_line(const Puzzle &puzzle, Solution &solution, int line,
+                    UpdateResult &update_result, SolverStats &stats,
+                    const SolverContext &context) {
+  solution.sync_line(line);
+  bool computed = update_line(puzzle, solution, line, update_result, context);
+  return apply_line_update(solution, line, update_result, computed, stats);
+}
+
+bool propagate_sweep(const Puzzle &puzzle, Solution &solution,
+                     SolverStats &stats, const SolverContext &context) {
+  auto &update_result = line_scratch().m_update;
   bool updated = true;
-  UpdateResult update_result;
   while (updated) {
     updated = false;
-
-    for (int j = 0; j < puzzle.m_width; ++j) {
-      if (solution.is_column_solved(j)) {
+    for (int k = 0; k < puzzle.m_width + puzzle.m_height; ++k) {
+      // columns first, then rows
+      auto line = k < puzzle.m_width ? solution.column_line(k)
+                                     : solution.row_line(k - puzzle.m_width);
+      if (solution.get_line(line).m_solved_flg) {
         continue;
       }
-      const auto &column = solution.get_column(j);
-      update_result = update_cells(puzzle.m_vertical_rules[j], column);
-      if (!update_result.m_rules_fit) {
-        return solution;
+      if (solution.m_line_changes[line] == 0) {
+        ++stats.m_line_solves_skipped;
+        continue;
       }
-      if (update_result.m_line_solved) {
-        solution.mark_column_solved(j);
+      updated = true;
+      if (!propagate_line(puzzle, solution, line, update_result, stats,
+                          context)) {
+        return false;
       }
-      updated = updated || update_result.m_line_updated;
-      solution.set_column(j, update_result.m_cells,
-                          std::move(update_result.m_lfit.value()),
-                          std::move(update_result.m_rfit.value()));
     }
+  }
+  return true;
+}
 
-    for (int i = 0; i < puzzle.m_height; ++i) {
-      if (solution.is_row_solved(i)) {
+// Alternates between all changed columns and all changed rows. The lines of
+// one orientation do not share cells, so each batch is solved on the pool
+// and then written back in index order.
+bool propagate_parallel(const Puzzle &puzzle, Solution &solution,
+                        SolverStats &stats, const SolverContext &context) {
+  std::vector<int> batch;
+  std::vector<UpdateResult> results;
+  // whether each result was computed rather than found in the cache
+  std::vector<char> computed;
+  bool rows = false;
+  int idle_batches = 0;
+  while (idle_batches < 2) {
+    batch.clear();
+    int n_lines = rows ? solution.m_height : solution.m_width;
+    for (int k = 0; k < n_lines; ++k) {
+      auto line = rows ? solution.row_line(k) : solution.column_line(k);
+      if (solution.get_line(line).m_solved_flg) {
         continue;
       }
-      const auto &row = solution.get_row(i);
-      update_result = update_cells(puzzle.m_horizontal_rules[i], row);
-      if (!update_result.m_rules_fit) {
-        return solution;
+      if (solution.m_line_changes[line] == 0) {
+        ++stats.m_line_solves_skipped;
+        continue;
       }
-      if (update_result.m_line_solved) {
-        solution.mark_row_solved(i);
+      batch.push_back(line);
+    }
+    rows = !rows;
+    if (batch.empty()) {
+      ++idle_batches;
+      continue;
+    }
+    idle_batches = 0;
+
+    if (results.size() < batch.size()) {
+      results.resize(batch.size());
+      computed.resize(batch.size());
+    }
+    // workers only read the grid, so it is synced up front
+    for (auto line : batch) {
+      solution.sync_line(line);
+    }
+    context.m_pool->parallel_for(batch.size(), [&](int k) {
+      computed[k] =
+          update_line(puzzle, solution, batch[k], results[k], context);
+    });
+    for (int k = 0; k < batch.size(); ++k) {
+      if (!apply_line_update(solution, batch[k], results[k], computed[k],
+                             stats)) {
+        return false;
       }
-      updated = updated || update_result.m_line_updated;
-      solution.set_row(i, update_result.m_cells,
-                       std::move(update_result.m_lfit.value()),
-                       std::move(update_result.m_rfit.value()));
     }
   }
 
-  for (int i = 0; i < solution.m_height; ++i) {
-    for (int j = 0; j < solution.m_width; ++j) {
-      if (solution.get_cell(i, j) == Cell::UNKNOWN) {
-        for (auto bt_value : {Cell::FILLED, Cell::EMPTY}) {
-          auto solution_bt = solution;
-          solution_bt.set_cell(i, j, bt_value);
-          auto next_solution = solve_iter(puzzle, solution_bt);
-          if (next_solution.m_is_final) {
-            return next_solution;
-          }
+  // lines queued by the write-backs have all been solved
+  while (solution.m_queue.pop()) {
+  }
+  return true;
+}
+
+bool propagate_to_fixpoint(const Puzzle &puzzle, Solution &solution,
+                           SolverStats &stats, const SolverContext &context) {
+  if (context.m_pool != nullptr) {
+    return propagate_parallel(puzzle, solution, stats, context);
+  }
+  if (solution.m_queue.m_order == PropagationOrder::SWEEP) {
+    return propagate_sweep(puzzle, solution, stats, context);
+  }
+
+  auto &update_result = line_scratch().m_update;
+  auto &queue = solution.m_queue;
+  auto coalesced_before = queue.m_coalesced;
+  bool rules_fit = true;
+  while (auto line = queue.pop()) {
+    if (solution.get_line(*line).m_solved_flg) {
+      continue;
+    }
+    if (!propagate_line(puzzle, solution, *line, update_result, stats,
+                        context)) {
+      rules_fit = false;
+      break;
+    }
+  }
+  stats.m_line_solves_skipped += queue.m_coalesced - coalesced_before;
+  return rules_fit;
+}
+
+// Alternates between the lines and the nogoods of context until neither
+// fixes a cell
+bool propagate_with_nogoods(const Puzzle &puzzle, Solution &solution,
+                            SolverStats &stats, const SolverContext &context) {
+  bool consistent = propagate_to_fixpoint(puzzle, solution, stats, context);
+  while (consistent && context.m_nogoods != nullptr) {
+    auto fixed_before = stats.m_nogood_fixed_cells;
+    if (!context.m_nogoods->propagate(solution, stats)) {
+      return false;
+    }
+    if (stats.m_nogood_fixed_cells == fixed_before) {
+      break;
+    }
+    consistent = propagate_to_fixpoint(puzzle, solution, stats, context);
+  }
+  return consistent;
+}
+
+bool propagate(const Puzzle &puzzle, Solution &solution, SolverStats &stats,
+               const SolverContext &context) {
+  ++stats.m_propagation_rounds;
+  if (!stats.m_time_phases) {
+    return propagate_with_nogoods(puzzle, solution, stats, context);
+  }
+  auto begin = std::chrono::steady_clock::now();
+  bool rules_fit = propagate_with_nogoods(puzzle, solution, stats, context);
+  stats.m_propagate_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              std::chrono::steady_clock::now() - begin)
+                              .count();
+  return rules_fit;
+}
+
+SolverStats &SolverStats::operator+=(const SolverStats &other) {
+  m_line_solves += other.m_line_solves;
+  m_line_solves_skipped += other.m_line_solves_skipped;
+  m_search_nodes += other.m_search_nodes;
+  m_probes += other.m_probes;
+  m_probe_fixed_cells += other.m_probe_fixed_cells;
+  m_propagation_rounds += other.m_propagation_rounds;
+  m_row_updates += other.m_row_updates;
+  m_column_updates += other.m_column_updates;
+  m_dp_states += other.m_dp_states;
+  m_fits_computed += other.m_fits_computed;
+  m_fits_reused += other.m_fits_reused;
+  m_propagation_fixed_cells += other.m_propagation_fixed_cells;
+  m_search_fixed_cells += other.m_search_fixed_cells;
+  m_max_depth = std::max(m_max_depth, other.m_max_depth);
+  m_backtracks += other.m_backtracks;
+  m_nogoods += other.m_nogoods;
+  m_nogood_fixed_cells += other.m_nogood_fixed_cells;
+  m_backjumped_levels += other.m_backjumped_levels;
+  m_placement_table_bytes =
+      std::max(m_placement_table_bytes, other.m_placement_table_bytes);
+  m_propagate_ns += other.m_propagate_ns;
+  return *this;
+}
+
+bool propagate(const Puzzle &puzzle, Solution &solution) {
+  SolverStats stats;
+  return propagate(puzzle, solution, stats);
+}
+
+struct SearchFrame {
+  BranchDecision m_decision;
+  // trail position before the branch cell was set
+  size_t m_trail_mark;
+  int m_next_value;
+  // When learning, the depths of the earlier decisions that the failures of
+  // the values tried so far follow from. Once a branch below found a
+  // solution, the frame depends on every earlier decision.
+  std::vector<int> m_conflicts;
+  bool m_chronological{false};
+};
+
+std::vector<int> all_depths(size_t depth) {
+  std::vector<int> depths(depth);
+  std::iota(depths.begin(), depths.end(), 0);
+  return depths;
+}
+
+// Conflict learning state of one search
+struct SearchLearning {
+  static constexpr size_t kMaxNogoods = 2000;
+
+  explicit SearchLearning(const Solution &solution)
+      : m_nogoods(kMaxNogoods, solution.m_width, solution.m_height),
+        m_analysis(solution) {}
+
+  // Finds the decisions on stack that the failed propagation of its last
+  // branch follows from, and records their values as a nogood
+  std::vector<int> analyze(const Solution &solution,
+                           const std::vector<SearchFrame> &stack,
+                           SolverStats &stats) {
+    m_marks.clear();
+    for (const auto &frame : stack) {
+      m_marks.push_back(frame.m_trail_mark);
+    }
+    auto conflicts = m_analysis.decisions(solution, m_marks, m_nogoods);
+    m_literals.clear();
+    for (auto d : conflicts) {
+      const auto &decision = stack[d].m_decision;
+      m_literals.push_back(
+          {.m_i = decision.m_i,
+           .m_j = decision.m_j,
+           .m_value = decision.m_values[stack[d].m_next_value - 1]});
+    }
+    if (m_nogoods.add(m_literals)) {
+      ++stats.m_nogoods;
+    }
+    return conflicts;
+  }
+
+  Nogoods m_nogoods;
+  ConflictAnalysis m_analysis;
+  std::vector<size_t> m_marks;
+  std::vector<Nogoods::Literal> m_literals;
+};
+
+// Fails the current value of the last frame on stack, which follows from the
+// decisions at depths conflicts. Frames after the latest of them took no part
+// and are dropped, so that the search goes on with the next value of that
+// one, which inherits the rest. Empties stack if there are no such decisions.
+void backjump(std::vector<SearchFrame> &stack, std::vector<int> conflicts,
+              SolverStats &stats) {
+  if (conflicts.empty()) {
+    stack.clear();
+    return;
+  }
+  const int target = conflicts.back();
+  conflicts.pop_back();
+  stats.m_backjumped_levels += stack.size() - 1 - target;
+  stack.erase(stack.begin() + target + 1, stack.end());
+  auto &merged = stack.back().m_conflicts;
+  std::vector<int> both;
+  std::ranges::set_union(merged, conflicts, std::back_inserter(both));
+  merged = std::move(both);
+}
+
+// Depth-first search over unknown cells. The solution is modified in place
+// and branches are undone through its trail, and pending decisions are kept
+// on an explicit stack, so neither memory nor the call stack grows with the
+// grid size times the search depth. on_solution is called on every solution
+// in turn until it returns false, which stops the search at that solution.
+// Returns SOLVED if it was stopped, UNSOLVABLE if it ran out of branches and
+// TIMED_OUT if it ran out of budget, leaving solution at the root fixpoint.
+// With m_learning, failed branches are traced back to their decisions, which
+// are propagated as nogoods from then on, and the search backjumps past the
+// decisions that took no part.
+SolveStatus search(const Puzzle &puzzle, Solution &solution,
+                   const SolverOptions &options, SolverStats &stats,
+                   const SolverContext &outer_context,
+                   const std::function<bool(const Solution &)> &on_solution) {
+  const SearchBudget budget(options);
+  const long nodes_before = stats.m_search_nodes;
+  std::optional<SearchLearning> learning;
+  SolverContext context = outer_context;
+  if (options.m_learning) {
+    context.m_nogoods = &learning.emplace(solution).m_nogoods;
+  }
+  ++stats.m_search_nodes;
+  if (!propagate(puzzle, solution, stats, context)) {
+    return SolveStatus::UNSOLVABLE;
+  }
+
+  solution.start_recording();
+  std::vector<SearchFrame> stack;
+  while (true) {
+    // a failed probe makes this node a dead end, like a failed propagation
+    if (options.m_probe_budget == 0 ||
+        probe(puzzle, solution, options, stats, context)) {
+      auto decision = choose_branch(solution, options);
+      if (!decision.has_value()) {
+        if (!on_solution(solution)) {
+          solution.stop_recording();
+          return SolveStatus::SOLVED;
+        }
+        for (auto &frame : stack) {
+          frame.m_chronological = true;
+        }
+      } else {
+        stack.push_back({.m_decision = decision.value(),
+                         .m_trail_mark = solution.m_trail.mark(),
+                         .m_next_value = 0});
+        stats.m_max_depth = std::max<long>(stats.m_max_depth, stack.size());
+      }
+    } else if (learning.has_value()) {
+      // the conflicts of probes are not traced
+      backjump(stack, all_depths(stack.size()), stats);
+    }
+
+    // take the next branch that propagates, backtracking as needed
+    bool descended = false;
+    while (!descended && !stack.empty()) {
+      if (budget.exhausted(stats.m_search_nodes - nodes_before)) {
+        // back to the root fixpoint, the first frame's state
+        solution.undo_to(stack.front().m_trail_mark);
+        solution.stop_recording();
+        return SolveStatus::TIMED_OUT;
+      }
+      auto &frame = stack.back();
+      if (frame.m_next_value > 0) {
+        ++stats.m_backtracks;
+      }
+      solution.undo_to(frame.m_trail_mark);
+      const auto &decision = frame.m_decision;
+      if (frame.m_next_value == decision.m_values.size()) {
+        auto conflicts = std::move(frame.m_conflicts);
+        bool chronological = frame.m_chronological;
+        stack.pop_back();
+        if (learning.has_value()) {
+          // every value failed, for the reasons gathered in the frame
+          backjump(stack,
+                   chronological ? all_depths(stack.size())
+                                 : std::move(conflicts),
+                   stats);
         }
-        solution.m_is_final = false;
-        return solution;
+        continue;
       }
+      ++stats.m_search_nodes;
+      ++stats.m_search_fixed_cells;
+      solution.m_conflict = Trail::kUnknownReason;
+      solution.set_cell(decision.m_i, decision.m_j,
+                        decision.m_values[frame.m_next_value++],
+                        Trail::kDecision);
+      descended = propagate(puzzle, solution, stats, context);
+      if (!descended && learning.has_value()) {
+        backjump(stack, learning->analyze(solution, stack, stats), stats);
+      }
+    }
+    if (!descended) {
+      solution.stop_recording();
+      return SolveStatus::UNSOLVABLE;
     }
   }
+}
 
-  solution.m_is_final = true;
+Solution solve_iter(const Puzzle &puzzle, Solution &solution,
+                    const SolverOptions &options, SolverStats &stats,
+                    const SolverContext &context) {
+  solution.m_status = search(puzzle, solution, options, stats, context,
+                             [](const Solution &) { return false; });
+  solution.m_is_final = solution.m_status == SolveStatus::SOLVED;
   return solution;
 }
 
-Solution solve_puzzle(const Puzzle &puzzle) {
+SearchBudget::SearchBudget(const SolverOptions &options)
+    : m_node_limit(options.m_node_limit) {
+  if (options.m_time_limit.count() > 0) {
+    m_deadline = std::chrono::steady_clock::now() + options.m_time_limit;
+  }
+}
+
+bool SearchBudget::exhausted(long nodes) const {
+  if (m_node_limit > 0 && nodes >= m_node_limit) {
+    return true;
+  }
+  return m_deadline.has_value() &&
+         std::chrono::steady_clock::now() >= m_deadline.value();
+}
+
+// Creates the resources of context requested by options and not given
+struct OwnedContext {
+  OwnedContext(const Puzzle &puzzle, const SolverOptions &options,
+               LineCache *cache, PlacementTables *tables,
+               ThreadPool *pool = nullptr) {
+    if (cache == nullptr && options.m_line_cache_capacity > 0) {
+      cache = &m_cache.emplace(options.m_line_cache_capacity);
+    }
+    // the parallel search does not solve lines in parallel
+    if (options.m_threads <= 1 || options.m_search_threads > 1) {
+      pool = nullptr;
+    } else if (pool == nullptr) {
+      // the calling thread takes part in every batch
+      pool = &m_pool.emplace(options.m_threads - 1);
+    }
+    if (options.m_placement_table_cells > 0) {
+      if (tables == nullptr) {
+        tables = &m_tables.emplace(options.m_placement_table_cells);
+      }
+      // lines are numbered rows first, as in Solution
+      for (const auto &rules : puzzle.m_horizontal_rules) {
+        m_line_tables.push_back(tables->get(rules, puzzle.m_width));
+      }
+      for (const auto &rules : puzzle.m_vertical_rules) {
+        m_line_tables.push_back(tables->get(rules, puzzle.m_height));
+      }
+      m_used_tables = tables;
+    }
+    m_context = {.m_pool = pool,
+                 .m_cache = cache,
+                 .m_line_tables = m_line_tables};
+  }
+
+  // Reports the footprint of the tables into stats
+  void report(SolverStats &stats) const {
+    if (m_used_tables != nullptr) {
+      stats.m_placement_table_bytes = m_used_tables->memory_bytes();
+    }
+  }
+
+  std::optional<LineCache> m_cache;
+  std::optional<ThreadPool> m_pool;
+  std::optional<PlacementTables> m_tables;
+  PlacementTables *m_used_tables{nullptr};
+  std::vector<const PlacementTable *> m_line_tables;
+  SolverContext m_context;
+};
+
+Solution solve_puzzle(const Puzzle &puzzle, const SolverOptions &options,
+                      SolverStats &stats, LineCache *cache,
+                      PlacementTables *tables, ThreadPool *pool) {
+  reserve_line_scratch(puzzle, options);
   Solution initial_solution(puzzle.m_width, puzzle.m_height,
-                            puzzle.m_vertical_rules, puzzle.m_horizontal_rules);
-  auto solution = solve_iter(puzzle, initial_solution);
+                            puzzle.m_vertical_rules, puzzle.m_horizontal_rules,
+                            options.m_propagation_order);
+  OwnedContext owned(puzzle, options, cache, tables, pool);
+  auto solution =
+      options.m_search_threads > 1
+          ? search_parallel(puzzle, initial_solution, options, stats,
+                            owned.m_context)
+          : solve_iter(puzzle, initial_solution, options, stats,
+                       owned.m_context);
+  owned.report(stats);
   return solution;
 }
+
+CountResult count_solutions(const Puzzle &puzzle, long limit,
+                            const SolverOptions &options, SolverStats &stats,
+                            LineCache *cache, PlacementTables *tables) {
+  reserve_line_scratch(puzzle, options);
+  Solution solution(puzzle.m_width, puzzle.m_height, puzzle.m_vertical_rules,
+                    puzzle.m_horizontal_rules, options.m_propagation_order);
+  OwnedContext owned(puzzle, options, cache, tables);
+  CountResult result;
+  if (limit <= 0) {
+    return result;
+  }
+  auto status = search(puzzle, solution, options, stats, owned.m_context,
+                       [&](const Solution &found) {
+                         if (result.m_witnesses.size() < 2) {
+                           auto &witness =
+                               result.m_witnesses.emplace_back(found);
+                           witness.stop_recording();
+                           witness.m_is_final = true;
+                           witness.m_status = SolveStatus::SOLVED;
+                         }
+                         return ++result.m_count < limit;
+                       });
+  result.m_timed_out = status == SolveStatus::TIMED_OUT;
+  owned.report(stats);
+  return result;
+}
+
+Solution solve_puzzle(const Puzzle &puzzle) {
+  SolverStats stats;
+  return solve_puzzle(puzzle, SolverOptions{}, stats);
+}
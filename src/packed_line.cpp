@@ -0,0 +1,215 @@
+#include "packed_line.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace {
+
+using Word = PackedLine::Word;
+constexpr int kWordBits = PackedLine::kWordBits;
+
+int words_for(int size) { return (size + kWordBits - 1) / kWordBits; }
+
+// Mask with bits [0, n) set, n in [0, 64]
+Word low_bits(int n) { return n >= kWordBits ? ~Word{0} : (Word{1} << n) - 1; }
+
+bool range_has_bits(const std::vector<Word> &words, int begin, int end) {
+  if (begin >= end) {
+    return false;
+  }
+  int first_word = begin / kWordBits;
+  int last_word = (end - 1) / kWordBits;
+  Word first_mask = ~low_bits(begin % kWordBits);
+  Word last_mask = low_bits((end - 1) % kWordBits + 1);
+  if (first_word == last_word) {
+    return words[first_word] & first_mask & last_mask;
+  }
+  if (words[first_word] & first_mask) {
+    return true;
+  }
+  if (words[last_word] & last_mask) {
+    return true;
+  }
+  int i = first_word + 1;
+#ifdef __AVX2__
+  for (; i + 4 <= last_word; i += 4) {
+    auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&words[i]));
+    if (!_mm256_testz_si256(v, v)) {
+      return true;
+    }
+  }
+#endif
+  Word acc = 0;
+  for (; i < last_word; ++i) {
+    acc |= words[i];
+  }
+  return acc != 0;
+}
+
+// Packs up to 64 cells starting at cells[0] with stride `step` (1 or -1)
+void pack_word(const Cell *cells, int count, int step, Word &filled,
+               Word &empty) {
+  filled = 0;
+  empty = 0;
+  int i = 0;
+#ifdef __AVX2__
+  static_assert(sizeof(Cell) == sizeof(int));
+  if (step == 1) {
+    const auto filled_v = _mm256_set1_epi32(static_cast<int>(Cell::FILLED));
+    const auto empty_v = _mm256_set1_epi32(static_cast<int>(Cell::EMPTY));
+    for (; i + 8 <= count; i += 8) {
+      auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(cells + i));
+      auto f = _mm256_movemask_ps(
+          _mm256_castsi256_ps(_mm256_cmpeq_epi32(v, filled_v)));
+      auto e = _mm256_movemask_ps(
+          _mm256_castsi256_ps(_mm256_cmpeq_epi32(v, empty_v)));
+      filled |= static_cast<Word>(f) << i;
+      empty |= static_cast<Word>(e) << i;
+    }
+  }
+#endif
+  for (; i < count; ++i) {
+    auto c = cells[i * step];
+    filled |= static_cast<Word>(c == Cell::FILLED) << i;
+    empty |= static_cast<Word>(c == Cell::EMPTY) << i;
+  }
+}
+
+// Reverses the first size bits of from into to, which has the same number of
+// words
+void reverse_words(const std::vector<Word> &from, int size,
+                   std::vector<Word> &to) {
+  const int n = from.size();
+  // reversing whole words puts bit size - 1 at bit pad, so shift it down
+  const int pad = n * kWordBits - size;
+  for (int w = 0; w < n; ++w) {
+    Word low = reverse_bits(from[n - 1 - w]) >> pad;
+    Word high = pad == 0 || w + 1 == n
+                    ? 0
+                    : reverse_bits(from[n - 2 - w]) << (kWordBits - pad);
+    to[w] = low | high;
+  }
+}
+
+void build_rank(const std::vector<Word> &words, std::vector<int> &rank) {
+  rank.resize(words.size() + 1);
+  rank[0] = 0;
+  for (int w = 0; w < words.size(); ++w) {
+    rank[w + 1] = rank[w] + std::popcount(words[w]);
+  }
+}
+
+// Number of set bits in [0, end)
+int rank_of(const std::vector<Word> &words, const std::vector<int> &rank,
+            int end) {
+  int w = end / kWordBits;
+  int offset = end % kWordBits;
+  if (offset == 0) {
+    return rank[w];
+  }
+  return rank[w] + std::popcount(words[w] & low_bits(offset));
+}
+
+} // namespace
+
+Word reverse_bits(Word word) {
+  word = ((word >> 1) & 0x5555555555555555) | ((word & 0x5555555555555555) << 1);
+  word = ((word >> 2) & 0x3333333333333333) | ((word & 0x3333333333333333) << 2);
+  word = ((word >> 4) & 0x0F0F0F0F0F0F0F0F) | ((word & 0x0F0F0F0F0F0F0F0F) << 4);
+  return std::byteswap(word);
+}
+
+PackedLine::PackedLine(int size)
+    : m_size(size), m_filled(words_for(size), 0), m_empty(words_for(size), 0) {
+}
+
+void PackedLine::assign(const Cell *cells, int size) {
+  m_size = size;
+  m_filled.resize(words_for(size));
+  m_empty.resize(words_for(size));
+  for (int w = 0; w < m_filled.size(); ++w) {
+    int begin = w * kWordBits;
+    int count = std::min(kWordBits, size - begin);
+    pack_word(cells + begin, count, 1, m_filled[w], m_empty[w]);
+  }
+}
+
+void PackedLine::assign_reversed(const Cell *cells, int size) {
+  m_size = size;
+  m_filled.resize(words_for(size));
+  m_empty.resize(words_for(size));
+  for (int w = 0; w < m_filled.size(); ++w) {
+    int begin = w * kWordBits;
+    int count = std::min(kWordBits, size - begin);
+    pack_word(cells + (size - 1 - begin), count, -1, m_filled[w], m_empty[w]);
+  }
+}
+
+void PackedLine::assign_words(const Word *filled, const Word *empty,
+                              int size) {
+  m_size = size;
+  m_filled.assign(filled, filled + words_for(size));
+  m_empty.assign(empty, empty + words_for(size));
+}
+
+void PackedLine::assign_reversed(const PackedLine &line) {
+  assert(&line != this);
+  m_size = line.m_size;
+  m_filled.resize(line.m_filled.size());
+  m_empty.resize(line.m_empty.size());
+  reverse_words(line.m_filled, m_size, m_filled);
+  reverse_words(line.m_empty, m_size, m_empty);
+}
+
+Cell PackedLine::get(int i) const {
+  if (is_filled(i)) {
+    return Cell::FILLED;
+  }
+  if (is_empty(i)) {
+    return Cell::EMPTY;
+  }
+  return Cell::UNKNOWN;
+}
+
+void PackedLine::set(int i, Cell value) {
+  assert(0 <= i && i < m_size);
+  auto bit = Word{1} << (i % kWordBits);
+  auto &filled = m_filled[i / kWordBits];
+  auto &empty = m_empty[i / kWordBits];
+  filled &= ~bit;
+  empty &= ~bit;
+  if (value == Cell::FILLED) {
+    filled |= bit;
+  } else if (value == Cell::EMPTY) {
+    empty |= bit;
+  }
+}
+
+bool PackedLine::has_filled(int begin, int end) const {
+  return range_has_bits(m_filled, begin, end);
+}
+
+bool PackedLine::has_empty(int begin, int end) const {
+  return range_has_bits(m_empty, begin, end);
+}
+
+void PackedLineIndex::build(const PackedLine &line) {
+  m_line = &line;
+  build_rank(line.m_filled, m_filled_rank);
+  build_rank(line.m_empty, m_empty_rank);
+}
+
+int PackedLineIndex::count_filled(int begin, int end) const {
+  return rank_of(m_line->m_filled, m_filled_rank, end) -
+         rank_of(m_line->m_filled, m_filled_rank, begin);
+}
+
+int PackedLineIndex::count_empty(int begin, int end) const {
+  return rank_of(m_line->m_empty, m_empty_rank, end) -
+         rank_of(m_line->m_empty, m_empty_rank, begin);
+}
@@ -0,0 +1,167 @@
+#include "nonogram.hpp"
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <ranges>
+#include <thread>
+
+namespace {
+
+// Pending search states of one worker. The owner works LIFO at the back,
+// thieves take the oldest (and usually largest) subtrees from the front.
+struct WorkDeque {
+  void push(Solution &&state) {
+    std::lock_guard lock(m_mutex);
+    m_states.push_back(std::move(state));
+  }
+
+  std::optional<Solution> pop() {
+    std::lock_guard lock(m_mutex);
+    if (m_states.empty()) {
+      return std::nullopt;
+    }
+    auto state = std::move(m_states.back());
+    m_states.pop_back();
+    return state;
+  }
+
+  std::optional<Solution> steal() {
+    std::lock_guard lock(m_mutex);
+    if (m_states.empty()) {
+      return std::nullopt;
+    }
+    auto state = std::move(m_states.front());
+    m_states.pop_front();
+    return state;
+  }
+
+  std::mutex m_mutex;
+  std::deque<Solution> m_states;
+};
+
+struct SharedSearch {
+  explicit SharedSearch(int n_workers) : m_deques(n_workers) {}
+
+  std::vector<WorkDeque> m_deques;
+  // states queued or being expanded; the search is over when it drops to 0
+  std::atomic<long> m_pending{0};
+  std::atomic<bool> m_cancelled{false};
+  std::mutex m_result_mutex;
+  std::optional<Solution> m_result;
+  // states expanded by all workers, checked against the budget
+  std::atomic<long> m_nodes{0};
+  std::atomic<bool> m_timed_out{false};
+  // the root after propagation, returned if the budget runs out
+  std::optional<Solution> m_fixpoint;
+};
+
+void search_worker(const Puzzle &puzzle, const SolverOptions &options,
+                   const SearchBudget &budget, const SolverContext &context,
+                   SharedSearch &shared, int worker, SolverStats &stats) {
+  reserve_line_scratch(puzzle, options);
+  const int n_workers = shared.m_deques.size();
+  auto &own = shared.m_deques[worker];
+  while (!shared.m_cancelled.load(std::memory_order_relaxed) &&
+         shared.m_pending.load() > 0) {
+    auto state = own.pop();
+    for (int k = 1; !state.has_value() && k < n_workers; ++k) {
+      state = shared.m_deques[(worker + k) % n_workers].steal();
+    }
+    if (!state.has_value()) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    auto node = shared.m_nodes.fetch_add(1);
+    if (budget.exhausted(node)) {
+      shared.m_timed_out = true;
+      shared.m_cancelled = true;
+      --shared.m_pending;
+      break;
+    }
+    ++stats.m_search_nodes;
+    bool consistent = propagate(puzzle, *state, stats, context);
+    if (consistent && options.m_probe_budget > 0) {
+      state->start_recording();
+      consistent = probe(puzzle, *state, options, stats, context);
+      state->stop_recording();
+    }
+    if (consistent && node == 0) {
+      // only the root is expanded as node 0, and it is read after the join
+      shared.m_fixpoint = *state;
+    }
+    if (consistent) {
+      auto decision = choose_branch(*state, options);
+      if (!decision.has_value()) {
+        state->m_is_final = true;
+        state->m_status = SolveStatus::SOLVED;
+        std::lock_guard lock(shared.m_result_mutex);
+        if (!shared.m_result.has_value()) {
+          shared.m_result = std::move(*state);
+        }
+        shared.m_cancelled = true;
+      } else {
+        shared.m_pending += decision->m_values.size();
+        // pushed in reverse, so that the first value is tried first
+        for (auto value : decision->m_values | std::views::reverse) {
+          Solution child = *state;
+          child.set_cell(decision->m_i, decision->m_j, value);
+          ++stats.m_search_fixed_cells;
+          own.push(std::move(child));
+        }
+      }
+    } else {
+      ++stats.m_backtracks;
+    }
+    --shared.m_pending;
+  }
+}
+
+} // namespace
+
+Solution search_parallel(const Puzzle &puzzle, const Solution &root,
+                         const SolverOptions &options, SolverStats &stats,
+                         const SolverContext &context) {
+  const int n_threads = options.m_search_threads;
+  SharedSearch shared(n_threads);
+  shared.m_deques[0].push(Solution(root));
+  shared.m_pending = 1;
+
+  const SearchBudget budget(options);
+  // every worker solves its lines on its own thread
+  const SolverContext worker_context{.m_cache = context.m_cache,
+                                     .m_line_tables = context.m_line_tables};
+  std::vector<SolverStats> worker_stats(n_threads);
+  for (auto &s : worker_stats) {
+    s.m_time_phases = stats.m_time_phases;
+  }
+  std::vector<std::thread> workers;
+  for (int k = 0; k < n_threads; ++k) {
+    workers.emplace_back(search_worker, std::cref(puzzle), std::cref(options),
+                         std::cref(budget), std::cref(worker_context),
+                         std::ref(shared), k, std::ref(worker_stats[k]));
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  for (const auto &s : worker_stats) {
+    stats += s;
+    stats.m_thread_nodes.push_back(s.m_search_nodes);
+  }
+
+  if (shared.m_result.has_value()) {
+    return std::move(shared.m_result.value());
+  }
+  if (shared.m_timed_out && shared.m_fixpoint.has_value()) {
+    auto solution = std::move(shared.m_fixpoint.value());
+    solution.m_status = SolveStatus::TIMED_OUT;
+    return solution;
+  }
+  Solution solution = root;
+  solution.m_is_final = false;
+  solution.m_status =
+      shared.m_timed_out ? SolveStatus::TIMED_OUT : SolveStatus::UNSOLVABLE;
+  return solution;
+}
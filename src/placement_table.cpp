@@ -0,0 +1,188 @@
+#include "placement_table.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <mutex>
+
+namespace {
+
+using Mask = std::uint32_t;
+
+Mask low_mask(int n) {
+  return n >= kPlacementTableCells ? ~Mask{0} : (Mask{1} << n) - 1;
+}
+
+// Cells taken by rules r.. with one cell between blocks
+std::vector<int> min_lengths(const RulesLine &rules) {
+  std::vector<int> lengths(rules.size() + 1, 0);
+  for (int r = static_cast<int>(rules.size()) - 1; r >= 0; --r) {
+    lengths[r] = rules[r] + (r + 1 < rules.size() ? 1 + lengths[r + 1] : 0);
+  }
+  return lengths;
+}
+
+// Appends every placement of rules r.. starting at from or later
+void place_rules(const RulesLine &rules, const std::vector<int> &lengths,
+                 int r, int from, Mask mask, std::vector<std::uint8_t> &starts,
+                 PlacementTable &table) {
+  if (r == rules.size()) {
+    table.m_masks.push_back(mask);
+    table.m_starts.insert(table.m_starts.end(), starts.begin(), starts.end());
+    return;
+  }
+  for (int s = from; s + lengths[r] <= table.m_size; ++s) {
+    starts[r] = s;
+    place_rules(rules, lengths, r + 1, s + rules[r] + 1,
+                mask | (low_mask(rules[r]) << s), starts, table);
+  }
+}
+
+// Line size, then the rules, one byte each
+void make_key(const RulesLine &rules, int size, std::string &key) {
+  key.clear();
+  key.push_back(static_cast<char>(size));
+  for (auto rule : rules) {
+    key.push_back(static_cast<char>(rule));
+  }
+}
+
+std::string &key_buffer() {
+  thread_local std::string key;
+  return key;
+}
+
+} // namespace
+
+long count_placements(const RulesLine &rules, int size, long limit) {
+  const long k = rules.size();
+  const long slack = size - min_lengths(rules)[0];
+  if (slack < 0) {
+    return 0;
+  }
+  // C(slack + k, k), which grows with each factor
+  long count = 1;
+  for (long i = 1; i <= k; ++i) {
+    count = count * (slack + i) / i;
+    if (count > limit) {
+      return count;
+    }
+  }
+  return count;
+}
+
+PlacementTable::PlacementTable(const RulesLine &rules, int size)
+    : m_size(size), m_n_rules(rules.size()) {
+  assert(size <= kPlacementTableCells);
+  auto count = count_placements(rules, size, kMaxTablePlacements);
+  m_masks.reserve(count);
+  m_starts.reserve(count * m_n_rules);
+  std::vector<std::uint8_t> starts(m_n_rules);
+  place_rules(rules, min_lengths(rules), 0, 0, 0, starts, *this);
+}
+
+void PlacementTable::update(const PackedLine &cells,
+                            UpdateResult &result) const {
+  assert(cells.size() == m_size);
+  const Mask filled = cells.m_filled.empty() ? 0 : cells.m_filled[0];
+  const Mask empty = cells.m_empty.empty() ? 0 : cells.m_empty[0];
+  auto consistent = [&](Mask mask) {
+    return ((mask & empty) | (filled & ~mask)) == 0;
+  };
+  result.m_dp_states = 0;
+
+  const size_t count = m_masks.size();
+  size_t first = 0;
+  while (first < count && !consistent(m_masks[first])) {
+    ++first;
+  }
+  if (first == count) {
+    result.m_rules_fit = false;
+    result.m_line_updated = false;
+    result.m_line_solved = false;
+    return;
+  }
+  size_t last = count - 1;
+  while (!consistent(m_masks[last])) {
+    --last;
+  }
+  // cells filled by all consistent placements, and by any of them
+  Mask all = ~Mask{0};
+  Mask any = 0;
+  for (size_t p = first; p <= last; ++p) {
+    auto mask = m_masks[p];
+    bool keep = consistent(mask);
+    all &= keep ? mask : ~Mask{0};
+    any |= keep ? mask : 0;
+  }
+
+  if (!result.m_lfit.has_value()) {
+    result.m_lfit.emplace();
+  }
+  if (!result.m_rfit.has_value()) {
+    result.m_rfit.emplace();
+  }
+  result.m_lfit->assign(&m_starts[first * m_n_rules],
+                        &m_starts[(first + 1) * m_n_rules]);
+  result.m_rfit->assign(&m_starts[last * m_n_rules],
+                        &m_starts[(last + 1) * m_n_rules]);
+
+  const Mask new_filled = all;
+  const Mask new_empty = ~any & low_mask(m_size);
+  assert((new_filled & filled) == filled && (new_empty & empty) == empty);
+  result.m_rules_fit = true;
+  result.m_line_updated = new_filled != filled || new_empty != empty;
+  result.m_line_solved = first == last;
+  result.m_cells.resize(m_size);
+  for (int k = 0; k < m_size; ++k) {
+    result.m_cells[k] = (new_filled >> k) & 1  ? Cell::FILLED
+                        : (new_empty >> k) & 1 ? Cell::EMPTY
+                                               : Cell::UNKNOWN;
+  }
+}
+
+size_t PlacementTable::memory_bytes() const {
+  return sizeof(PlacementTable) + m_masks.capacity() * sizeof(Mask) +
+         m_starts.capacity();
+}
+
+PlacementTables::PlacementTables(int max_cells)
+    : m_max_cells(std::min(max_cells, kPlacementTableCells)) {}
+
+const PlacementTable *PlacementTables::get(const RulesLine &rules, int size) {
+  if (size > m_max_cells) {
+    return nullptr;
+  }
+  auto &key = key_buffer();
+  make_key(rules, size, key);
+  {
+    std::shared_lock lock(m_mutex);
+    auto it = m_tables.find(key);
+    if (it != m_tables.end()) {
+      return it->second.get();
+    }
+  }
+
+  std::unique_ptr<PlacementTable> table;
+  if (count_placements(rules, size, kMaxTablePlacements) <=
+      kMaxTablePlacements) {
+    table = std::make_unique<PlacementTable>(rules, size);
+  }
+  std::unique_lock lock(m_mutex);
+  // another thread may have built the same table first
+  auto [it, inserted] = m_tables.try_emplace(key, std::move(table));
+  if (inserted) {
+    m_bytes += key.size() + (it->second ? it->second->memory_bytes() : 0);
+  }
+  return it->second.get();
+}
+
+size_t PlacementTables::size() const {
+  std::shared_lock lock(m_mutex);
+  size_t size = 0;
+  for (const auto &[key, table] : m_tables) {
+    size += table != nullptr;
+  }
+  return size;
+}
+
+size_t PlacementTables::memory_bytes() const { return m_bytes; }
@@ -0,0 +1,88 @@
+#include "nonogram.hpp"
+
+#include <cassert>
+
+namespace {
+
+// Sets (i, j) to value, propagates, records what got fixed and undoes it all
+void run_probe(const Puzzle &puzzle, Solution &solution, int i, int j,
+               Cell value, SolverStats &stats, const SolverContext &context,
+               ProbeOutcome &outcome) {
+  auto mark = solution.m_trail.mark();
+  ++stats.m_probes;
+  solution.set_cell(i, j, value);
+  outcome.m_rules_fit = propagate(puzzle, solution, stats, context);
+  outcome.m_cells.clear();
+  if (outcome.m_rules_fit) {
+    for (auto k = mark; k < solution.m_trail.mark(); ++k) {
+      const auto &entry = solution.m_trail.m_entries[k];
+      if (entry.m_kind == Trail::Entry::Kind::CELL) {
+        outcome.m_cells.emplace_back(entry.m_a, entry.m_b,
+                                     solution.get_cell(entry.m_a, entry.m_b));
+      }
+    }
+  }
+  solution.undo_to(mark);
+}
+
+} // namespace
+
+bool probe(const Puzzle &puzzle, Solution &solution,
+           const SolverOptions &options, SolverStats &stats,
+           const SolverContext &context) {
+  assert(solution.m_recording);
+  auto &scratch = probe_scratch();
+  auto &filled = scratch.m_filled;
+  auto &empty = scratch.m_empty;
+  // sized by reserve_line_scratch
+  auto &filled_values = scratch.m_filled_values;
+  assert(filled_values.size() >= size_t{1} * solution.m_width *
+                                     solution.m_height);
+  int budget = options.m_probe_budget;
+  bool progress = true;
+  while (progress && budget > 0) {
+    progress = false;
+    for (int i = 0; i < solution.m_height && budget > 0; ++i) {
+      for (int j = 0; j < solution.m_width && budget > 0; ++j) {
+        if (solution.get_cell(i, j) != Cell::UNKNOWN) {
+          continue;
+        }
+        --budget;
+        run_probe(puzzle, solution, i, j, Cell::FILLED, stats, context, filled);
+        run_probe(puzzle, solution, i, j, Cell::EMPTY, stats, context, empty);
+
+        if (!filled.m_rules_fit && !empty.m_rules_fit) {
+          return false;
+        }
+        auto fixed_before = stats.m_probe_fixed_cells;
+        if (!filled.m_rules_fit || !empty.m_rules_fit) {
+          // the other value is forced
+          solution.set_cell(i, j,
+                            filled.m_rules_fit ? Cell::FILLED : Cell::EMPTY);
+          ++stats.m_probe_fixed_cells;
+        } else {
+          // both values agree on these cells
+          for (auto [ci, cj, value] : filled.m_cells) {
+            filled_values[ci * solution.m_width + cj] = value;
+          }
+          for (auto [ci, cj, value] : empty.m_cells) {
+            if (filled_values[ci * solution.m_width + cj] == value) {
+              solution.set_cell(ci, cj, value);
+              ++stats.m_probe_fixed_cells;
+            }
+          }
+          for (auto [ci, cj, value] : filled.m_cells) {
+            filled_values[ci * solution.m_width + cj] = Cell::UNKNOWN;
+          }
+        }
+        if (stats.m_probe_fixed_cells != fixed_before) {
+          progress = true;
+          if (!propagate(puzzle, solution, stats, context)) {
+            return false;
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
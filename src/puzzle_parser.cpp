@@ -0,0 +1,187 @@
+#include "puzzle_parser.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+// Number of space separated tokens in line
+int count_tokens(std::string_view line) {
+  int tokens = 0;
+  bool in_token = false;
+  for (char c : line) {
+    bool space = is_space(c);
+    tokens += in_token && space;
+    in_token = !space;
+  }
+  return tokens + in_token;
+}
+
+void skip_spaces(std::string_view line, size_t &pos) {
+  while (pos < line.size() && is_space(line[pos])) {
+    ++pos;
+  }
+}
+
+// Parses the integer at line[pos], or returns nullopt at the end of line
+std::optional<int> parse_int(std::string_view line, size_t &pos, int line_no) {
+  skip_spaces(line, pos);
+  if (pos == line.size()) {
+    return std::nullopt;
+  }
+  int value;
+  auto line_end = line.data() + line.size();
+  auto [end, ec] = std::from_chars(line.data() + pos, line_end, value);
+  if (ec != std::errc() || (end != line_end && !is_space(*end))) {
+    auto token_end = line.find_first_of(" \t\r", pos);
+    throw ParseError(line_no,
+                     "expected a number, got '" +
+                         std::string(line.substr(pos, token_end - pos)) + "'");
+  }
+  pos = end - line.data();
+  return value;
+}
+
+} // namespace
+
+ParseError::ParseError(int line, const std::string &message)
+    : std::runtime_error("line " + std::to_string(line) + ": " + message),
+      m_line(line) {}
+
+std::optional<std::pair<int, int>> parse_header(std::string_view line,
+                                                int line_no) {
+  size_t pos = 0;
+  auto width = parse_int(line, pos, line_no);
+  if (!width.has_value()) {
+    return std::nullopt;
+  }
+  auto height = parse_int(line, pos, line_no);
+  if (!height.has_value() || parse_int(line, pos, line_no).has_value()) {
+    throw ParseError(line_no, "expected a header 'width height'");
+  }
+  if (*width <= 0 || *height <= 0) {
+    throw ParseError(line_no, "puzzle sides must be positive");
+  }
+  if (*width > Puzzle::kMaxSide || *height > Puzzle::kMaxSide) {
+    throw ParseError(line_no, "puzzle sides must be at most " +
+                                  std::to_string(Puzzle::kMaxSide));
+  }
+  return std::pair{*width, *height};
+}
+
+void parse_rules_line(std::string_view line, int line_no, int line_size,
+                      RulesLine &rule) {
+  // one allocation per line
+  rule.reserve(count_tokens(line));
+  size_t pos = 0;
+  int cells = -1;
+  while (auto value = parse_int(line, pos, line_no)) {
+    if (*value <= 0) {
+      throw ParseError(line_no,
+                       "rules must be positive, got " + std::to_string(*value));
+    }
+    rule.push_back(*value);
+    cells += *value + 1;
+  }
+  if (cells > line_size) {
+    throw ParseError(line_no, "rules need " + std::to_string(cells) +
+                                  " cells, but the line has " +
+                                  std::to_string(line_size));
+  }
+}
+
+std::string_view PuzzleParser::next_line() {
+  auto end = m_data.find('\n', m_pos);
+  if (end == std::string_view::npos) {
+    end = m_data.size();
+  }
+  auto line = m_data.substr(m_pos, end - m_pos);
+  m_pos = std::min(end + 1, m_data.size());
+  ++m_line;
+  return line;
+}
+
+void PuzzleParser::read_rules(std::vector<RulesLine> &rules, int line_size) {
+  for (auto &rule : rules) {
+    if (m_pos == m_data.size()) {
+      throw ParseError(m_line, "unexpected end of input, expected " +
+                                   std::to_string(rules.size()) +
+                                   " lines of rules");
+    }
+    int line_no = m_line;
+    parse_rules_line(next_line(), line_no, line_size, rule);
+  }
+}
+
+std::optional<Puzzle> PuzzleParser::next() {
+  while (m_pos < m_data.size()) {
+    int line_no = m_line;
+    auto sides = parse_header(next_line(), line_no);
+    if (!sides.has_value()) {
+      // blank separator line
+      continue;
+    }
+    auto [width, height] = *sides;
+    Puzzle puzzle(width, height);
+    read_rules(puzzle.m_vertical_rules, height);
+    read_rules(puzzle.m_horizontal_rules, width);
+    return puzzle;
+  }
+  return std::nullopt;
+}
+
+MappedFile::MappedFile(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::system_error(errno, std::generic_category(), path);
+  }
+  struct stat st;
+  if (::fstat(fd, &st) < 0) {
+    int error = errno;
+    ::close(fd);
+    throw std::system_error(error, std::generic_category(), path);
+  }
+  if (!S_ISREG(st.st_mode)) {
+    char chunk[1 << 16];
+    ssize_t n;
+    while ((n = ::read(fd, chunk, sizeof(chunk))) > 0) {
+      m_buffer.append(chunk, n);
+    }
+    int error = errno;
+    ::close(fd);
+    if (n < 0) {
+      throw std::system_error(error, std::generic_category(), path);
+    }
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+    return;
+  }
+  m_size = st.st_size;
+  if (m_size > 0) {
+    void *data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      int error = errno;
+      ::close(fd);
+      throw std::system_error(error, std::generic_category(), path);
+    }
+    ::madvise(data, m_size, MADV_SEQUENTIAL);
+    m_data = static_cast<const char *>(data);
+    m_mapped = true;
+  }
+  ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (m_mapped) {
+    ::munmap(const_cast<char *>(m_data), m_size);
+  }
+}
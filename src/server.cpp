@@ -0,0 +1,358 @@
+#include "server.hpp"
+#include "puzzle_parser.hpp"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <semaphore>
+#include <sstream>
+#include <system_error>
+#include <thread>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+long nanoseconds_between(Clock::time_point begin, Clock::time_point end) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin)
+      .count();
+}
+
+// Buffered reads from a file descriptor
+struct FdReader {
+  explicit FdReader(int fd) : m_fd(fd) {}
+
+  // Reads up to the next newline, which is dropped. A line longer than
+  // max_size is cut to its first max_size + 1 bytes, so the buffer never
+  // holds more than that. Returns false at the end of input.
+  bool read_line(std::string &line, size_t max_size) {
+    while (true) {
+      auto end = m_buffer.find('\n', m_pos);
+      if (end != std::string::npos && end - m_pos <= max_size) {
+        line.assign(m_buffer, m_pos, end - m_pos);
+        m_pos = end + 1;
+        return true;
+      }
+      if (m_buffer.size() - m_pos > max_size) {
+        line.assign(m_buffer, m_pos, max_size + 1);
+        m_pos += max_size + 1;
+        return true;
+      }
+      if (!fill()) {
+        return false;
+      }
+    }
+  }
+
+  // Reads exactly n bytes. Returns false if the input ends first.
+  bool read_bytes(size_t n, std::string &bytes) {
+    while (m_buffer.size() - m_pos < n) {
+      if (!fill()) {
+        return false;
+      }
+    }
+    bytes.assign(m_buffer, m_pos, n);
+    m_pos += n;
+    return true;
+  }
+
+  // Drops n bytes without holding them all. Returns false if the input ends
+  // first.
+  bool skip_bytes(size_t n) {
+    while (m_buffer.size() - m_pos < n) {
+      n -= m_buffer.size() - m_pos;
+      m_pos = m_buffer.size();
+      if (!fill()) {
+        return false;
+      }
+    }
+    m_pos += n;
+    return true;
+  }
+
+  bool fill() {
+    m_buffer.erase(0, m_pos);
+    m_pos = 0;
+    char chunk[1 << 16];
+    ssize_t n;
+    do {
+      n = ::read(m_fd, chunk, sizeof(chunk));
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+      return false;
+    }
+    m_buffer.append(chunk, n);
+    return true;
+  }
+
+  int m_fd;
+  std::string m_buffer;
+  size_t m_pos{0};
+};
+
+// Writes all of data. Returns false if the reader has gone away.
+bool write_all(int fd, std::string_view data) {
+  while (!data.empty()) {
+    ssize_t n = ::write(fd, data.data(), data.size());
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data.remove_prefix(n);
+  }
+  return true;
+}
+
+const char *status_name(SolveStatus status) {
+  switch (status) {
+  case SolveStatus::SOLVED:
+    return "solved";
+  case SolveStatus::UNSOLVABLE:
+    return "unsolvable";
+  case SolveStatus::TIMED_OUT:
+    return "timed_out";
+  }
+  return "error";
+}
+
+// Status and text of the answer to a request body
+struct Answer {
+  std::string m_status;
+  std::string m_text;
+};
+
+std::string answer_header(const std::string &id, const Answer &answer,
+                          long queue_ns, long solve_ns) {
+  return id + " " + answer.m_status + " " + std::to_string(queue_ns) + " " +
+         std::to_string(solve_ns) + " " +
+         std::to_string(answer.m_text.size()) + "\n";
+}
+
+// Removes the socket file at path, if there is one
+void remove_socket(const std::string &path) {
+  struct stat st;
+  if (::lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+    ::unlink(path.c_str());
+  }
+}
+
+// Answers a request body
+Answer solve_request(const std::string &body, const ServerOptions &options,
+                     LineCache *cache, PlacementTables *tables,
+                     ThreadPool *line_pool) {
+  PuzzleParser parser(body);
+  auto puzzle = parser.next();
+  if (!puzzle.has_value()) {
+    throw ParseError(parser.m_line, "no puzzle in request");
+  }
+  long cells = long{puzzle->m_width} * puzzle->m_height;
+  if (cells > options.m_max_cells) {
+    return {"error", "puzzle of " + std::to_string(cells) +
+                         " cells is larger than " +
+                         std::to_string(options.m_max_cells) + "\n"};
+  }
+  SolverStats stats;
+  auto solution =
+      solve_puzzle(*puzzle, options.m_solver, stats, cache, tables, line_pool);
+  std::ostringstream text;
+  print_solution(text, solution);
+  return {status_name(solution.m_status), text.str()};
+}
+
+} // namespace
+
+SolverServer::SolverServer(const ServerOptions &options)
+    : m_options(options), m_pool(std::max(1, options.m_jobs)) {
+  if (options.m_solver.m_line_cache_capacity > 0) {
+    m_cache.emplace(options.m_solver.m_line_cache_capacity);
+  }
+  if (options.m_solver.m_placement_table_cells > 0) {
+    m_tables.emplace(options.m_solver.m_placement_table_cells);
+  }
+  // shared by the requests being solved; the thread of each takes part
+  if (options.m_solver.m_threads > 1 &&
+      options.m_solver.m_search_threads <= 1) {
+    m_line_pool.emplace(options.m_solver.m_threads - 1);
+  }
+}
+
+void SolverServer::serve(int in_fd, int out_fd) {
+  const int max_in_flight = std::max(1, m_options.m_max_in_flight);
+  std::counting_semaphore<> slots(max_in_flight);
+  std::mutex write_mutex;
+  auto send = [&](const std::string &header, const std::string &text) {
+    std::lock_guard lock(write_mutex);
+    // a reader that went away only loses its answers
+    write_all(out_fd, header) && write_all(out_fd, text);
+  };
+  auto *cache = m_cache ? &m_cache.value() : nullptr;
+  auto *tables = m_tables ? &m_tables.value() : nullptr;
+  auto *line_pool = m_line_pool ? &m_line_pool.value() : nullptr;
+
+  FdReader reader(in_fd);
+  std::string line;
+  const size_t max_header = m_options.m_max_header_bytes;
+  try {
+    while (reader.read_line(line, max_header)) {
+      if (line.empty()) {
+        continue;
+      }
+      if (line.size() > max_header) {
+        // the rest of the stream cannot be framed
+        Answer error{"error", "request header longer than " +
+                                  std::to_string(max_header) + " bytes\n"};
+        send(answer_header("-", error, 0, 0), error.m_text);
+        break;
+      }
+      std::istringstream header(line);
+      std::string command;
+      std::string id;
+      long length = -1;
+      header >> command >> id >> length;
+      if (!header || command != "solve" || length < 0) {
+        // the rest of the stream cannot be framed
+        Answer error{"error", "malformed request header: " + line + "\n"};
+        send(answer_header("-", error, 0, 0), error.m_text);
+        break;
+      }
+      if (length > m_options.m_max_request_bytes) {
+        if (!reader.skip_bytes(length)) {
+          break;
+        }
+        Answer error{"error",
+                     "request of " + std::to_string(length) +
+                         " bytes is longer than " +
+                         std::to_string(m_options.m_max_request_bytes) + "\n"};
+        send(answer_header(id, error, 0, 0), error.m_text);
+        ++m_requests;
+        continue;
+      }
+      std::string body;
+      if (!reader.read_bytes(length, body)) {
+        break;
+      }
+
+      slots.acquire();
+      m_pool.submit([&, id = std::move(id), body = std::move(body),
+                     received = Clock::now()] {
+        // the slot comes back however the request ends
+        struct SlotRelease {
+          ~SlotRelease() { m_slots.release(); }
+          std::counting_semaphore<> &m_slots;
+        } release{slots};
+        auto begin = Clock::now();
+        Answer answer;
+        try {
+          answer = solve_request(body, m_options, cache, tables, line_pool);
+        } catch (const std::exception &e) {
+          // a request that cannot be solved, e.g. for lack of memory, only
+          // fails itself
+          answer = {"error", std::string(e.what()) + "\n"};
+        }
+        auto end = Clock::now();
+        send(answer_header(id, answer, nanoseconds_between(received, begin),
+                           nanoseconds_between(begin, end)),
+             answer.m_text);
+        ++m_requests;
+      });
+    }
+  } catch (const std::exception &e) {
+    // e.g. no memory for a body; the answers under way still go out
+    Answer error{"error", std::string(e.what()) + "\n"};
+    send(answer_header("-", error, 0, 0), error.m_text);
+  }
+  // every slot comes back once all answers are written
+  for (int k = 0; k < max_in_flight; ++k) {
+    slots.acquire();
+  }
+}
+
+void SolverServer::serve_socket(const std::string &path,
+                                const std::atomic<bool> &stop) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw std::system_error(ENAMETOOLONG, std::generic_category(), path);
+  }
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+  int listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listener < 0) {
+    throw std::system_error(errno, std::generic_category(), path);
+  }
+  // a socket left by an earlier run
+  remove_socket(path);
+  if (::bind(listener, reinterpret_cast<const sockaddr *>(&address),
+             sizeof(address)) < 0 ||
+      ::listen(listener, SOMAXCONN) < 0) {
+    int error = errno;
+    ::close(listener);
+    throw std::system_error(error, std::generic_category(), path);
+  }
+
+  struct Connection {
+    int m_fd;
+    std::atomic<bool> m_done{false};
+    std::thread m_thread;
+  };
+  std::list<Connection> connections;
+  // guards the fds of open connections against being shut down as they close
+  std::mutex fds_mutex;
+  auto reap = [&](bool all) {
+    for (auto it = connections.begin(); it != connections.end();) {
+      if (all || it->m_done) {
+        it->m_thread.join();
+        it = connections.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  };
+
+  while (!stop) {
+    pollfd ready{.fd = listener, .events = POLLIN};
+    // wakes up now and then to check stop
+    if (::poll(&ready, 1, 100) <= 0) {
+      continue;
+    }
+    int fd = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      continue;
+    }
+    reap(false);
+    auto &connection = connections.emplace_back(fd);
+    connection.m_thread = std::thread([&, fd, done = &connection.m_done] {
+      try {
+        serve(fd, fd);
+      } catch (const std::exception &) {
+        // a connection that fails only closes itself
+      }
+      std::lock_guard lock(fds_mutex);
+      ::close(fd);
+      *done = true;
+    });
+  }
+
+  {
+    // ends the requests of the open connections; their answers still go out
+    std::lock_guard lock(fds_mutex);
+    for (auto &connection : connections) {
+      if (!connection.m_done) {
+        ::shutdown(connection.m_fd, SHUT_RD);
+      }
+    }
+  }
+  reap(true);
+  ::close(listener);
+  remove_socket(path);
+}
@@ -0,0 +1,133 @@
+#include "short_line.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <ranges>
+
+namespace {
+
+using Mask = PackedLine::Word;
+// one cell between blocks
+constexpr int kMaxRules = (kShortLineCells + 1) / 2;
+
+Mask low_mask(int n) {
+  return n >= kShortLineCells ? ~Mask{0} : (Mask{1} << n) - 1;
+}
+
+Mask shift_up(Mask mask, int n) {
+  return n >= kShortLineCells ? 0 : mask << n;
+}
+
+Mask shift_down(Mask mask, int n) {
+  return n >= kShortLineCells ? 0 : mask >> n;
+}
+
+// Starts of the blocks of length cells that cover no empty cell and do not
+// touch a filled cell on either side
+Mask block_starts(Mask filled, Mask empty, int n, int length) {
+  Mask runs = ~empty & low_mask(n);
+  // runs keeps the starts of covered non-empty cells, doubling each step
+  for (int covered = 1; covered < length;) {
+    int step = std::min(covered, length - covered);
+    runs &= runs >> step;
+    covered += step;
+  }
+  return runs & ~(filled << 1) & ~shift_down(filled, length);
+}
+
+// Sets starts[r] to the starts of rule r at which rules 0..r fit the cells
+// up to the end of rule r without leaving a filled cell uncovered
+template <typename RulesRange>
+void fit_prefixes(const RulesRange &rules, Mask filled, Mask empty, int n,
+                  Mask *starts) {
+  const Mask gaps = ~filled & low_mask(n);
+  // the first block cannot start past the first filled cell
+  Mask allowed = low_mask(std::countr_zero(filled) + 1);
+  for (int r = 0; r < rules.size(); ++r) {
+    starts[r] = block_starts(filled, empty, n, rules[r]) & allowed;
+    // the cell after each placement may start a gap, which runs until the
+    // next filled cell: adding the seeds to the gaps carries through the
+    // rest of their runs
+    Mask seeds = shift_up(starts[r], rules[r]) & gaps;
+    Mask reach = (gaps & ~(gaps + seeds)) | seeds;
+    allowed = reach << 1;
+  }
+}
+
+} // namespace
+
+void update_short_line(const RulesLine &rules, const PackedLine &cells,
+                       UpdateResult &result) {
+  const int n = cells.size();
+  const int n_rules = rules.size();
+  assert(n <= kShortLineCells && n_rules > 0);
+  const Mask filled = cells.m_filled.empty() ? 0 : cells.m_filled[0];
+  const Mask empty = cells.m_empty.empty() ? 0 : cells.m_empty[0];
+  result.m_dp_states = 0;
+  if (n_rules > kMaxRules) {
+    result.m_rules_fit = false;
+    result.m_line_updated = false;
+    result.m_line_solved = false;
+    return;
+  }
+
+  // placements of the last rules are prefixes of the reversed line
+  std::array<Mask, kMaxRules> prefixes;
+  std::array<Mask, kMaxRules> suffixes;
+  const int pad = kShortLineCells - n;
+  fit_prefixes(rules, filled, empty, n, prefixes.data());
+  fit_prefixes(rules | std::views::reverse,
+               shift_down(reverse_bits(filled), pad),
+               shift_down(reverse_bits(empty), pad), n, suffixes.data());
+  result.m_dp_states = 2 * n_rules;
+
+  if (!result.m_lfit.has_value()) {
+    result.m_lfit.emplace();
+  }
+  if (!result.m_rfit.has_value()) {
+    result.m_rfit.emplace();
+  }
+  auto &lfit = *result.m_lfit;
+  auto &rfit = *result.m_rfit;
+  lfit.resize(n_rules);
+  rfit.resize(n_rules);
+  Mask covered = 0;
+  Mask overlap = 0;
+  bool line_solved = true;
+  for (int r = 0; r < n_rules; ++r) {
+    // a start s of rule r is n - rules[r] - s on the reversed line
+    int positions = n - rules[r] + 1;
+    Mask suffix = 0;
+    if (positions > 0) {
+      suffix = shift_down(reverse_bits(suffixes[n_rules - 1 - r]),
+                          kShortLineCells - positions);
+    }
+    Mask valid = prefixes[r] & suffix;
+    if (valid == 0) {
+      result.m_rules_fit = false;
+      result.m_line_updated = false;
+      result.m_line_solved = false;
+      return;
+    }
+    lfit[r] = std::countr_zero(valid);
+    rfit[r] = std::bit_width(valid) - 1;
+    line_solved = line_solved && lfit[r] == rfit[r];
+    covered |= low_mask(rfit[r] + rules[r]) & ~low_mask(lfit[r]);
+    overlap |= low_mask(lfit[r] + rules[r]) & ~low_mask(rfit[r]);
+  }
+
+  const Mask new_filled = filled | overlap;
+  const Mask new_empty = empty | (low_mask(n) & ~covered);
+  assert((new_filled & new_empty) == 0);
+  result.m_rules_fit = true;
+  result.m_line_updated = new_filled != filled || new_empty != empty;
+  result.m_line_solved = line_solved;
+  result.m_cells.resize(n);
+  for (int k = 0; k < n; ++k) {
+    result.m_cells[k] = (new_filled >> k) & 1  ? Cell::FILLED
+                        : (new_empty >> k) & 1 ? Cell::EMPTY
+                                               : Cell::UNKNOWN;
+  }
+}
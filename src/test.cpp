@@ -1,6 +1,24 @@
 #include <gtest/gtest.h>
 
+#include "alloc_counter.hpp"
+#include "batch.hpp"
+#include "binary_format.hpp"
+#include "bit_grid.hpp"
+#include "generator.hpp"
+#include "learning.hpp"
+#include "line_cache.hpp"
 #include "nonogram.hpp"
+#include "placement_table.hpp"
+#include "puzzle_parser.hpp"
+#include "server.hpp"
+#include "thread_pool.hpp"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <functional>
+#include <map>
+#include <random>
 
 RulesLine read_rules_line(const std::string &s) {
   RulesLine result;
@@ -69,6 +87,131 @@ TEST(TestParsing, TestReadCellsLine) {
   ASSERT_EQ(cells[2], Cell::FILLED);
 }
 
+TEST(TestPackedLine, TestRangeQueriesAcrossWords) {
+  CellsLine cells(200, Cell::UNKNOWN);
+  cells[3] = Cell::EMPTY;
+  cells[130] = Cell::FILLED;
+  PackedLine packed;
+  packed.assign(cells.data(), cells.size());
+  ASSERT_EQ(packed.get(3), Cell::EMPTY);
+  ASSERT_EQ(packed.get(130), Cell::FILLED);
+  ASSERT_EQ(packed.get(131), Cell::UNKNOWN);
+  ASSERT_TRUE(packed.has_filled(0, 200));
+  ASSERT_TRUE(packed.has_filled(130, 131));
+  ASSERT_FALSE(packed.has_filled(0, 130));
+  ASSERT_FALSE(packed.has_filled(131, 200));
+  ASSERT_TRUE(packed.has_empty(3, 4));
+  ASSERT_FALSE(packed.has_empty(4, 200));
+  ASSERT_FALSE(packed.has_empty(5, 5));
+}
+
+TEST(TestPackedLine, TestAssignReversed) {
+  auto cells = read_cells_line("X~~.");
+  PackedLine packed;
+  packed.assign_reversed(cells.data(), cells.size());
+  ASSERT_EQ(packed.get(0), Cell::EMPTY);
+  ASSERT_EQ(packed.get(1), Cell::UNKNOWN);
+  ASSERT_EQ(packed.get(3), Cell::FILLED);
+  packed.set(3, Cell::UNKNOWN);
+  ASSERT_FALSE(packed.has_filled(0, 4));
+}
+
+TEST(TestPackedLine, TestReversePackedLine) {
+  std::mt19937 rng(5);
+  for (int size : {1, 63, 64, 65, 130}) {
+    CellsLine cells(size);
+    for (auto &cell : cells) {
+      cell = static_cast<Cell>(rng() % 3);
+    }
+    PackedLine packed;
+    packed.assign(cells.data(), size);
+    PackedLine expected;
+    expected.assign_reversed(cells.data(), size);
+    PackedLine reversed;
+    reversed.assign_reversed(packed);
+    ASSERT_EQ(reversed.m_filled, expected.m_filled);
+    ASSERT_EQ(reversed.m_empty, expected.m_empty);
+  }
+}
+
+TEST(TestPackedLine, TestIndexCounts) {
+  CellsLine cells(128, Cell::UNKNOWN);
+  for (int i = 0; i < 128; i += 3) {
+    cells[i] = Cell::FILLED;
+  }
+  cells[64] = Cell::EMPTY;
+  PackedLine packed;
+  packed.assign(cells.data(), cells.size());
+  PackedLineIndex index(packed);
+  ASSERT_EQ(index.count_filled(0, 128), 43);
+  ASSERT_EQ(index.count_filled(1, 3), 0);
+  ASSERT_EQ(index.count_filled(63, 64), 1);
+  ASSERT_EQ(index.count_empty(0, 64), 0);
+  ASSERT_EQ(index.count_empty(64, 128), 1);
+  ASSERT_FALSE(index.has_filled(4, 4));
+}
+
+TEST(TestBitGrid, TestTransposeBlock) {
+  std::mt19937_64 rng(3);
+  BitGrid::Word block[BitGrid::kBlockBits];
+  for (auto &word : block) {
+    word = rng();
+  }
+  auto transposed = std::to_array(block);
+  transpose_block(transposed.data());
+  for (int r = 0; r < BitGrid::kBlockBits; ++r) {
+    for (int c = 0; c < BitGrid::kBlockBits; ++c) {
+      ASSERT_EQ((block[r] >> c) & 1, (transposed[c] >> r) & 1);
+    }
+  }
+}
+
+TEST(TestBitGrid, TestOrientationsStayInSync) {
+  // spans partial blocks in both directions
+  const int width = 100;
+  const int height = 70;
+  BitGrid grid(width, height);
+  std::vector<Cell> expected(width * height, Cell::UNKNOWN);
+  std::mt19937 rng(11);
+  PackedLine line;
+  for (int iter = 0; iter < 5000; ++iter) {
+    int i = rng() % height;
+    int j = rng() % width;
+    auto value = static_cast<Cell>(rng() % 3);
+    switch (rng() % 3) {
+    case 0:
+      grid.set(i, j, value);
+      break;
+    case 1:
+      grid.set_in_row(i, j, value);
+      break;
+    case 2:
+      grid.set_in_column(i, j, value);
+      break;
+    }
+    expected[i * width + j] = value;
+    ASSERT_EQ(grid.get(i, j), value);
+
+    if (iter % 50 == 0) {
+      int k = rng() % height;
+      grid.sync_row(k);
+      grid.load_row(k, line);
+      for (int c = 0; c < width; ++c) {
+        ASSERT_EQ(line.get(c), expected[k * width + c]);
+      }
+      k = rng() % width;
+      grid.sync_column(k);
+      grid.load_column(k, line);
+      for (int r = 0; r < height; ++r) {
+        ASSERT_EQ(line.get(r), expected[r * width + k]);
+      }
+    }
+  }
+  // two planes in each orientation, 2 bits per cell rounded up to words
+  ASSERT_EQ(grid.memory_bytes(),
+            2 * 8 * (height * 2 + width * 2) + 2 * 2);
+}
+
 TEST(TestSolutionLine, TestSolutionLineConstructorSimple) {
   std::string rules_str = "1 2";
   auto rules = read_rules_line(rules_str);
@@ -278,3 +421,948 @@ TEST(TestSolver, TestUpdateCellsRulesDoNotFit) {
   ASSERT_FALSE(update.m_rules_fit);
   ASSERT_FALSE(update.m_line_updated);
 }
+
+// Straightforward rightmost fit over plain cells, used as a reference for the
+// packed-line DP
+std::optional<std::vector<int>> reference_fit_right(const RulesLine &rules,
+                                                    const CellsLine &cells) {
+  int n = cells.size();
+  std::map<std::pair<int, int>, std::optional<int>> memo;
+  auto any_of = [&](int begin, int end, Cell value) {
+    for (int k = begin; k < end; ++k) {
+      if (cells[k] == value) {
+        return true;
+      }
+    }
+    return false;
+  };
+  std::function<bool(int, int)> can_fit = [&](int rule_i, int cell_i) {
+    if (rule_i == rules.size()) {
+      return !any_of(cell_i, n, Cell::FILLED);
+    }
+    auto key = std::make_pair(rule_i, cell_i);
+    if (auto it = memo.find(key); it != memo.end()) {
+      return it->second.has_value();
+    }
+    std::optional<int> found;
+    for (int i = n - rules[rule_i]; i >= cell_i; --i) {
+      int end = i + rules[rule_i];
+      if (any_of(cell_i, i, Cell::FILLED) || any_of(i, end, Cell::EMPTY) ||
+          (end < n && cells[end] == Cell::FILLED)) {
+        continue;
+      }
+      if (can_fit(rule_i + 1, std::min(n, end + 1))) {
+        found = i;
+        break;
+      }
+    }
+    memo[key] = found;
+    return found.has_value();
+  };
+  if (!can_fit(0, 0)) {
+    return std::nullopt;
+  }
+  std::vector<int> fit;
+  int cell_i = 0;
+  for (int rule_i = 0; rule_i < rules.size(); ++rule_i) {
+    int i = memo[{rule_i, cell_i}].value();
+    fit.push_back(i);
+    cell_i = std::min(n, i + rules[rule_i] + 1);
+  }
+  return fit;
+}
+
+TEST(TestSolver, TestFitMatchesReferenceOnLargeLines) {
+  std::mt19937 rng(42);
+  for (int iter = 0; iter < 50; ++iter) {
+    const int n = 300;
+    // random solved line, then hide most of it
+    CellsLine solved(n, Cell::EMPTY);
+    RulesLine rules;
+    for (int i = 0; i < n;) {
+      int gap = rng() % 6;
+      int block = 1 + rng() % 8;
+      i += gap;
+      if (i + block > n) {
+        break;
+      }
+      std::fill(solved.begin() + i, solved.begin() + i + block, Cell::FILLED);
+      rules.push_back(block);
+      i += block + 1;
+    }
+    CellsLine cells(n, Cell::UNKNOWN);
+    for (int i = 0; i < n; ++i) {
+      if (rng() % 4 == 0) {
+        cells[i] = solved[i];
+      }
+    }
+    auto line = make_solution_line(rules, cells);
+
+    auto rfit = fit_right(rules, line);
+    auto expected_rfit = reference_fit_right(rules, cells);
+    ASSERT_TRUE(rfit.has_value());
+    ASSERT_EQ(rfit, expected_rfit);
+
+    CellsLine reversed_cells(cells.rbegin(), cells.rend());
+    RulesLine reversed_rules(rules.rbegin(), rules.rend());
+    auto expected_lfit = reference_fit_right(reversed_rules, reversed_cells);
+    ASSERT_TRUE(expected_lfit.has_value());
+    std::reverse(expected_lfit->begin(), expected_lfit->end());
+    for (int k = 0; k < rules.size(); ++k) {
+      (*expected_lfit)[k] = n - (*expected_lfit)[k] - rules[k];
+    }
+    ASSERT_EQ(fit_left(rules, line), expected_lfit);
+  }
+}
+
+TEST(TestSolver, TestReusedFitsMatchFreshSolves) {
+  std::mt19937 rng(11);
+  int fits_reused = 0;
+  // lengths that fill their last word end the rightmost fit on it
+  const int lengths[] = {128, 150, 192};
+  for (int iter = 0; iter < 30; ++iter) {
+    const int n = lengths[iter % 3];
+    CellsLine solved(n, Cell::EMPTY);
+    RulesLine rules;
+    for (int i = rng() % 4; i + 5 <= n; i += 2 + rng() % 8) {
+      int block = 1 + rng() % 4;
+      std::fill(solved.begin() + i, solved.begin() + i + block, Cell::FILLED);
+      rules.push_back(block);
+      i += block;
+    }
+    // reveal the line a few cells at a time, keeping the fits of each solve
+    auto line = SolutionLine(n, rules);
+    UpdateResult result;
+    for (int step = 0; step < 30; ++step) {
+      for (int k = 0; k < 3; ++k) {
+        int i = rng() % n;
+        line.m_cells[i] = solved[i];
+      }
+      update_cells(rules, line, result);
+      fits_reused += result.m_fits_reused;
+      auto fresh = update_cells(rules, make_solution_line(rules, line.m_cells));
+      ASSERT_TRUE(result.m_rules_fit);
+      ASSERT_EQ(result.m_cells, fresh.m_cells);
+      ASSERT_EQ(result.m_lfit, fresh.m_lfit);
+      ASSERT_EQ(result.m_rfit, fresh.m_rfit);
+      ASSERT_EQ(result.m_line_solved, fresh.m_line_solved);
+      line.assign_fits(*result.m_lfit, *result.m_rfit);
+      line.m_cells = result.m_cells;
+    }
+  }
+  ASSERT_GT(fits_reused, 0);
+}
+
+TEST(TestSolver, TestPropagationDoesNotAllocate) {
+  // 3x3 puzzle solved by propagation alone
+  std::istringstream input("3 3\n3\n1\n3\n3\n1 1\n1 1\n");
+  auto puzzle = read_puzzle(input);
+  reserve_line_scratch(puzzle);
+  Solution solution(puzzle.m_width, puzzle.m_height, puzzle.m_vertical_rules,
+                    puzzle.m_horizontal_rules);
+  auto allocations_before = allocation_count();
+  auto propagated = propagate(puzzle, solution);
+  auto allocations = allocation_count() - allocations_before;
+  ASSERT_TRUE(propagated);
+  ASSERT_EQ(allocations, 0);
+  ASSERT_EQ(solution.get_cell(1, 0), Cell::FILLED);
+  ASSERT_EQ(solution.get_cell(1, 1), Cell::EMPTY);
+}
+
+TEST(TestSolver, TestProbingDoesNotAllocate) {
+  // the two diagonals of the top-left 2x2 square are left to probe
+  std::istringstream input("4 3\n1\n1\n\n3\n1 1\n1 1\n1\n");
+  auto puzzle = read_puzzle(input);
+  SolverOptions options{.m_probe_budget = 4};
+  reserve_line_scratch(puzzle, options);
+  Solution solution(puzzle.m_width, puzzle.m_height, puzzle.m_vertical_rules,
+                    puzzle.m_horizontal_rules);
+  ASSERT_TRUE(propagate(puzzle, solution));
+  solution.start_recording();
+  SolverStats stats;
+  // the first probes grow the trail and the probe outcomes
+  ASSERT_TRUE(probe(puzzle, solution, options, stats));
+  auto allocations_before = allocation_count();
+  auto probed = probe(puzzle, solution, options, stats);
+  auto allocations = allocation_count() - allocations_before;
+  ASSERT_TRUE(probed);
+  ASSERT_EQ(allocations, 0);
+  ASSERT_EQ(stats.m_probes, 16);
+}
+
+TEST(TestSolver, TestShortLinesMatchTheFittingDp) {
+  // a short line padded with empty cells past 64 takes the DP path
+  const int padding = 70;
+  std::mt19937 rng(13);
+  int fitted = 0;
+  for (int iter = 0; iter < 2000; ++iter) {
+    int n = 1 + rng() % 64;
+    RulesLine rules;
+    for (int used = 0; used < n && rng() % 4 != 0;) {
+      rules.push_back(1 + rng() % std::max(1, (n - used) / 2));
+      used += rules.back() + 1;
+    }
+    if (rules.empty()) {
+      continue;
+    }
+    CellsLine cells(n);
+    for (auto &cell : cells) {
+      auto r = rng() % 8;
+      cell = r == 0 ? Cell::FILLED : r == 1 ? Cell::EMPTY : Cell::UNKNOWN;
+    }
+    auto padded = cells;
+    padded.resize(n + padding, Cell::EMPTY);
+    auto expected = update_cells(rules, make_solution_line(rules, padded));
+    auto result = update_cells(rules, make_solution_line(rules, cells));
+    ASSERT_EQ(result.m_rules_fit, expected.m_rules_fit);
+    if (!expected.m_rules_fit) {
+      continue;
+    }
+    ASSERT_EQ(result.m_lfit, expected.m_lfit);
+    ASSERT_EQ(result.m_rfit, expected.m_rfit);
+    ASSERT_EQ(result.m_line_updated, expected.m_line_updated);
+    ASSERT_EQ(result.m_line_solved, expected.m_line_solved);
+    expected.m_cells.resize(n);
+    ASSERT_EQ(result.m_cells, expected.m_cells);
+    ++fitted;
+  }
+  ASSERT_GT(fitted, 200);
+}
+
+TEST(TestPlacementTable, TestTablesRefineTheFittingDp) {
+  PlacementTables tables(25);
+  std::mt19937 rng(17);
+  int fitted = 0;
+  for (int iter = 0; iter < 2000; ++iter) {
+    int n = 1 + rng() % 25;
+    RulesLine rules;
+    for (int used = 0; used < n && rng() % 4 != 0;) {
+      rules.push_back(1 + rng() % std::max(1, (n - used) / 2));
+      used += rules.back() + 1;
+    }
+    if (rules.empty()) {
+      continue;
+    }
+    CellsLine cells(n);
+    for (auto &cell : cells) {
+      auto r = rng() % 8;
+      cell = r == 0 ? Cell::FILLED : r == 1 ? Cell::EMPTY : Cell::UNKNOWN;
+    }
+    auto line = make_solution_line(rules, cells);
+    auto expected = update_cells(rules, line);
+    UpdateResult result;
+    update_cells(rules, line, result, tables.get(rules, n));
+    ASSERT_EQ(result.m_rules_fit, expected.m_rules_fit);
+    if (!expected.m_rules_fit) {
+      continue;
+    }
+    ASSERT_EQ(result.m_lfit, expected.m_lfit);
+    ASSERT_EQ(result.m_rfit, expected.m_rfit);
+    ASSERT_EQ(result.m_line_solved, expected.m_line_solved);
+    // every cell fixed by the fits is fixed the same way by the placements
+    for (int k = 0; k < n; ++k) {
+      if (expected.m_cells[k] != Cell::UNKNOWN) {
+        ASSERT_EQ(result.m_cells[k], expected.m_cells[k]);
+      }
+    }
+    ++fitted;
+  }
+  ASSERT_GT(fitted, 200);
+  ASSERT_GT(tables.size(), 0);
+  ASSERT_GT(tables.memory_bytes(), 0);
+}
+
+TEST(TestPlacementTable, TestTableFixesCellsBetweenTheFits) {
+  // the filled cell is either block, so both of its neighbours are empty,
+  // which the fits (0, 2) and (2, 4) alone leave unknown
+  RulesLine rules{1, 1};
+  CellsLine cells(5, Cell::UNKNOWN);
+  cells[2] = Cell::FILLED;
+  auto line = make_solution_line(rules, cells);
+  ASSERT_EQ(update_cells(rules, line).m_cells[1], Cell::UNKNOWN);
+  PlacementTables tables;
+  UpdateResult result;
+  update_cells(rules, line, result, tables.get(rules, 5));
+  ASSERT_TRUE(result.m_rules_fit);
+  ASSERT_EQ(result.m_cells, (CellsLine{Cell::UNKNOWN, Cell::EMPTY,
+                                       Cell::FILLED, Cell::EMPTY,
+                                       Cell::UNKNOWN}));
+  ASSERT_EQ(count_placements(RulesLine{1, 1}, 25, 1000), 276);
+  ASSERT_GT(count_placements(RulesLine(10, 1), 30, 1000), 1000);
+  ASSERT_EQ(count_placements(RulesLine{3, 3}, 6, 1000), 0);
+}
+
+TEST(TestPlacementTable, TestSolveWithPlacementTables) {
+  std::istringstream input(
+      "5 5\n2 1\n2 1\n1\n2 1\n2 1\n2 2\n2 2\n\n1 1\n3\n");
+  auto puzzle = read_puzzle(input);
+  SolverStats stats;
+  auto expected = solve_puzzle(puzzle, {}, stats);
+  for (int search_threads : {1, 3}) {
+    SolverStats table_stats;
+    auto solution = solve_puzzle(puzzle,
+                                 {.m_search_threads = search_threads,
+                                  .m_placement_table_cells = 25},
+                                 table_stats);
+    ASSERT_TRUE(solution.m_is_final);
+    for (int i = 0; i < puzzle.m_height; ++i) {
+      for (int j = 0; j < puzzle.m_width; ++j) {
+        ASSERT_EQ(solution.get_cell(i, j), expected.get_cell(i, j));
+      }
+    }
+    ASSERT_EQ(table_stats.m_dp_states, 0);
+    ASSERT_GT(table_stats.m_placement_table_bytes, 0);
+  }
+  ASSERT_EQ(stats.m_placement_table_bytes, 0);
+}
+
+TEST(TestSolver, TestFitVeryLongLine) {
+  const int n = 20000;
+  RulesLine rules(n / 2, 1);
+  auto line = SolutionLine(n, rules);
+  auto lfit = fit_left(rules, line);
+  auto rfit = fit_right(rules, line);
+  ASSERT_TRUE(lfit.has_value());
+  ASSERT_TRUE(rfit.has_value());
+  ASSERT_EQ(lfit->front(), 0);
+  ASSERT_EQ(lfit->back(), n - 2);
+  ASSERT_EQ(rfit->front(), 1);
+  ASSERT_EQ(rfit->back(), n - 1);
+}
+
+TEST(TestSolution, TestSetCellQueuesCrossingLines) {
+  std::vector<RulesLine> rules(3, RulesLine{1});
+  Solution solution(3, 3, rules, rules);
+  while (solution.m_queue.pop()) {
+  }
+  solution.set_cell(1, 2, Cell::FILLED);
+  solution.set_cell(1, 2, Cell::FILLED);
+  ASSERT_EQ(solution.m_queue.pop(), solution.row_line(1));
+  ASSERT_EQ(solution.m_queue.pop(), solution.column_line(2));
+  ASSERT_FALSE(solution.m_queue.pop().has_value());
+}
+
+TEST(TestSolver, TestPropagationOrdersAgree) {
+  std::istringstream input("5 5\n1 1\n5\n1 1\n5\n1 1\n1 1\n5\n1 1\n5\n1 1\n");
+  auto puzzle = read_puzzle(input);
+  std::optional<std::string> expected;
+  for (auto order : {PropagationOrder::SWEEP, PropagationOrder::FIFO,
+                     PropagationOrder::NEWLY_FIXED, PropagationOrder::SLACK}) {
+    for (int threads : {1, 3}) {
+      SolverStats stats;
+      auto solution = solve_puzzle(
+          puzzle, {.m_propagation_order = order, .m_threads = threads}, stats);
+      ASSERT_TRUE(solution.m_is_final);
+      std::ostringstream os;
+      print_solution(os, solution);
+      if (expected.has_value()) {
+        ASSERT_EQ(os.str(), expected.value());
+      }
+      expected = os.str();
+    }
+  }
+}
+
+TEST(TestThreadPool, TestParallelForVisitsEveryIndexOnce) {
+  ThreadPool pool(3);
+  std::vector<std::atomic<int>> visits(1000);
+  pool.parallel_for(visits.size(), [&](int k) { ++visits[k]; });
+  for (const auto &v : visits) {
+    ASSERT_EQ(v.load(), 1);
+  }
+}
+
+RulesLine runs_of(const CellsLine &cells) {
+  RulesLine runs;
+  int run = 0;
+  for (auto c : cells) {
+    if (c == Cell::FILLED) {
+      ++run;
+    } else if (run > 0) {
+      runs.push_back(run);
+      run = 0;
+    }
+  }
+  if (run > 0) {
+    runs.push_back(run);
+  }
+  return runs;
+}
+
+bool satisfies_rules(const Puzzle &puzzle, const Solution &solution) {
+  for (int i = 0; i < puzzle.m_height; ++i) {
+    if (runs_of(solution.line_cells(solution.row_line(i))) !=
+        puzzle.m_horizontal_rules[i]) {
+      return false;
+    }
+  }
+  for (int j = 0; j < puzzle.m_width; ++j) {
+    if (runs_of(solution.line_cells(solution.column_line(j))) !=
+        puzzle.m_vertical_rules[j]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+TEST(TestSolver, TestParallelSearchFindsSolution) {
+  // both diagonals of every 2x2 block are solutions
+  std::istringstream input("4 4\n1 1\n1 1\n1 1\n1 1\n1 1\n1 1\n1 1\n1 1\n");
+  auto puzzle = read_puzzle(input);
+  SolverStats stats;
+  auto solution = solve_puzzle(puzzle, {.m_search_threads = 3}, stats);
+  ASSERT_TRUE(solution.m_is_final);
+  ASSERT_TRUE(satisfies_rules(puzzle, solution));
+  ASSERT_EQ(stats.m_thread_nodes.size(), 3);
+}
+
+TEST(TestSolution, TestUndoRestoresCheckpoint) {
+  // two solutions, so propagation alone fixes nothing
+  std::istringstream input("2 2\n1\n1\n1\n1\n");
+  auto puzzle = read_puzzle(input);
+  Solution solution(puzzle.m_width, puzzle.m_height, puzzle.m_vertical_rules,
+                    puzzle.m_horizontal_rules);
+  solution.start_recording();
+  ASSERT_TRUE(propagate(puzzle, solution));
+  // undo_to needs a mark taken at a propagation fixpoint
+  auto fixpoint = solution;
+  auto mark = solution.m_trail.mark();
+  solution.set_cell(0, 0, Cell::FILLED);
+  ASSERT_TRUE(propagate(puzzle, solution));
+  ASSERT_TRUE(solution.is_row_solved(0));
+  solution.undo_to(mark);
+  for (int i = 0; i < puzzle.m_height; ++i) {
+    ASSERT_EQ(solution.line_cells(i), fixpoint.line_cells(i));
+    ASSERT_EQ(solution.get_row(i).m_lfit, fixpoint.get_row(i).m_lfit);
+    ASSERT_EQ(solution.get_row(i).m_rfit_reversed,
+              fixpoint.get_row(i).m_rfit_reversed);
+    ASSERT_FALSE(solution.is_row_solved(i));
+  }
+  ASSERT_EQ(solution.get_column(1).m_rfit, fixpoint.get_column(1).m_rfit);
+  ASSERT_FALSE(solution.m_queue.pop().has_value());
+
+  // the other branch propagates from the restored state
+  solution.set_cell(0, 0, Cell::EMPTY);
+  ASSERT_TRUE(propagate(puzzle, solution));
+  ASSERT_EQ(solution.get_cell(0, 1), Cell::FILLED);
+  ASSERT_EQ(solution.get_cell(1, 0), Cell::FILLED);
+}
+
+TEST(TestBranching, TestChooseBranchPolicies) {
+  // cell (0, 2) is the only one in two block windows of its row
+  std::vector<RulesLine> columns(5, RulesLine{1});
+  std::vector<RulesLine> rows{{1, 1}, {1}, {1}, {1}, {1}};
+  Solution solution(5, 5, columns, rows);
+  ASSERT_DOUBLE_EQ(fill_likelihood(solution, 0, 2),
+                   (2.0 / 3 + 1.0 / 5) / 2);
+
+  SolverOptions options;
+  auto first = choose_branch(solution, options);
+  ASSERT_TRUE(first.has_value());
+  ASSERT_EQ(first->m_i, 0);
+  ASSERT_EQ(first->m_j, 0);
+  ASSERT_EQ(first->m_values[0], Cell::FILLED);
+
+  options.m_branch_value = BranchValue::EMPTY_FIRST;
+  ASSERT_EQ(choose_branch(solution, options)->m_values[0], Cell::EMPTY);
+
+  options.m_branch_cell = BranchCell::MOST_CANDIDATE_BLOCKS;
+  options.m_branch_value = BranchValue::LIKELIHOOD;
+  auto covered = choose_branch(solution, options);
+  ASSERT_EQ(covered->m_i, 0);
+  ASSERT_EQ(covered->m_j, 2);
+  ASSERT_EQ(covered->m_values[0], Cell::EMPTY);
+
+  options.m_branch_cell = BranchCell::MOST_CONSTRAINED_LINE;
+  auto constrained = choose_branch(solution, options);
+  ASSERT_EQ(constrained->m_i, 0);
+  ASSERT_EQ(constrained->m_j, 0);
+  ASSERT_EQ(constrained->m_values[0], Cell::EMPTY);
+}
+
+TEST(TestProbing, TestProbingAvoidsSearch) {
+  // test_data/test_4.txt needs one branch without probing
+  std::istringstream input(
+      "5 5\n2 1\n2 1\n1\n2 1\n2 1\n2 2\n2 2\n\n1 1\n3\n");
+  auto puzzle = read_puzzle(input);
+  SolverStats stats;
+  auto solution = solve_puzzle(puzzle, {.m_probe_budget = 25}, stats);
+  ASSERT_TRUE(solution.m_is_final);
+  ASSERT_TRUE(satisfies_rules(puzzle, solution));
+  ASSERT_EQ(stats.m_search_nodes, 1);
+  ASSERT_GT(stats.m_probe_fixed_cells, 0);
+}
+
+TEST(TestLineCache, TestCachedUpdateMatchesUpdateCells) {
+  LineCache cache(64);
+  std::mt19937 rng(7);
+  for (int iter = 0; iter < 200; ++iter) {
+    const int n = 20;
+    auto rules = read_rules_line("2 3 1");
+    auto line = SolutionLine(n, rules);
+    for (auto &cell : line.m_cells) {
+      auto r = rng() % 6;
+      cell = r == 0 ? Cell::FILLED : r == 1 ? Cell::EMPTY : Cell::UNKNOWN;
+    }
+    auto expected = update_cells(rules, line);
+    PackedLine packed;
+    packed.assign(line.m_cells.data(), n);
+    UpdateResult cached;
+    if (!cache.lookup(rules, packed, cached)) {
+      cache.insert(rules, packed, expected);
+      ASSERT_TRUE(cache.lookup(rules, packed, cached));
+    }
+    ASSERT_EQ(cached.m_rules_fit, expected.m_rules_fit);
+    if (!expected.m_rules_fit) {
+      continue;
+    }
+    ASSERT_EQ(cached.m_line_updated, expected.m_line_updated);
+    ASSERT_EQ(cached.m_line_solved, expected.m_line_solved);
+    ASSERT_EQ(cached.m_cells, expected.m_cells);
+    ASSERT_EQ(cached.m_lfit, expected.m_lfit);
+    ASSERT_EQ(cached.m_rfit, expected.m_rfit);
+  }
+  ASSERT_LE(cache.size(), 64);
+  ASSERT_GT(cache.m_evictions, 0);
+}
+
+TEST(TestLineCache, TestSolveWithSharedCache) {
+  std::istringstream input(
+      "5 5\n2 1\n2 1\n1\n2 1\n2 1\n2 2\n2 2\n\n1 1\n3\n");
+  auto puzzle = read_puzzle(input);
+  LineCache cache(1000);
+  SolverStats first_stats;
+  auto first = solve_puzzle(puzzle, {}, first_stats, &cache);
+  auto misses = cache.m_misses.load();
+  SolverStats second_stats;
+  auto second = solve_puzzle(puzzle, {}, second_stats, &cache);
+  ASSERT_TRUE(second.m_is_final);
+  for (int i = 0; i < puzzle.m_height; ++i) {
+    for (int j = 0; j < puzzle.m_width; ++j) {
+      ASSERT_EQ(first.get_cell(i, j), second.get_cell(i, j));
+    }
+  }
+  // the second solve only sees lines the first one already solved
+  ASSERT_EQ(cache.m_misses, misses);
+  ASSERT_EQ(second_stats.m_row_updates + second_stats.m_column_updates, 0);
+  ASSERT_EQ(second_stats.m_dp_states, 0);
+  ASSERT_EQ(second_stats.m_propagation_fixed_cells,
+            first_stats.m_propagation_fixed_cells);
+}
+
+TEST(TestSolverStats, TestCountersOfSmallSearch) {
+  // no line can be solved alone, so one branch fixes a cell and propagation
+  // the other three
+  std::istringstream input("2 2\n1\n1\n1\n1\n");
+  auto puzzle = read_puzzle(input);
+  SolverStats stats;
+  stats.m_time_phases = true;
+  auto solution = solve_puzzle(puzzle, {}, stats);
+  ASSERT_TRUE(solution.m_is_final);
+  ASSERT_EQ(stats.m_row_updates + stats.m_column_updates,
+            stats.m_line_solves);
+  ASSERT_GT(stats.m_dp_states, 0);
+  ASSERT_EQ(stats.m_search_fixed_cells, 1);
+  ASSERT_EQ(stats.m_propagation_fixed_cells, 3);
+  ASSERT_EQ(stats.m_propagation_rounds, 2);
+  ASSERT_EQ(stats.m_max_depth, 1);
+  ASSERT_EQ(stats.m_backtracks, 0);
+  ASSERT_GT(stats.m_propagate_ns, 0);
+}
+
+TEST(TestBatch, TestBatchReportsEveryPuzzle) {
+  // a solvable puzzle, an unsolvable one and the first one again
+  std::string solvable = "2 2\n1\n1\n1\n1\n";
+  std::string unsolvable = "1 1\n1\n\n";
+  for (bool ordered : {true, false}) {
+    std::istringstream input(solvable + "\n" + unsolvable + solvable);
+    std::vector<int> indices;
+    std::map<int, bool> solved;
+    auto summary = solve_batch(input, {.m_jobs = 3, .m_ordered = ordered},
+                               [&](BatchResult &result) {
+                                 indices.push_back(result.m_index);
+                                 solved[result.m_index] = result.m_solved;
+                               });
+    ASSERT_EQ(summary.m_puzzles, 3);
+    ASSERT_EQ(summary.m_solved, 2);
+    if (ordered) {
+      ASSERT_EQ(indices, std::vector<int>({0, 1, 2}));
+    }
+    ASSERT_EQ(solved, (std::map<int, bool>{{0, true}, {1, false}, {2, true}}));
+  }
+}
+
+TEST(TestServer, TestServerAnswersPipelinedRequests) {
+  std::string unique = "3 3\n3\n1\n3\n3\n1 1\n1 1\n";
+  std::string unsolvable = "1 1\n1\n\n";
+  std::string truncated = "3 3\n3\n";
+  std::string huge = "2000000000 1\n";
+  std::string too_many_cells = "5 5\n1\n1\n1\n1\n1\n1\n1\n1\n1\n1\n";
+  std::string too_long(100, '\n');
+  std::string requests;
+  for (auto [id, body] :
+       {std::pair("a", unique), std::pair("b", unsolvable),
+        std::pair("c", truncated), std::pair("e", huge),
+        std::pair("f", too_many_cells), std::pair("g", too_long),
+        std::pair("d", unique)}) {
+    requests += std::string("solve ") + id + " " +
+                std::to_string(body.size()) + "\n" + body;
+  }
+  // a header that never ends is cut off rather than buffered
+  requests += "solve h " + std::string(8 << 10, '1');
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  ASSERT_EQ(write(fds[0], requests.data(), requests.size()), requests.size());
+  shutdown(fds[0], SHUT_WR);
+
+  // requests share the server's line solving threads
+  SolverServer server({.m_solver = {.m_threads = 2},
+                       .m_jobs = 2,
+                       .m_max_in_flight = 2,
+                       .m_max_request_bytes = 64,
+                       .m_max_cells = 16});
+  server.serve(fds[1], fds[1]);
+  close(fds[1]);
+  ASSERT_EQ(server.m_requests, 7);
+
+  std::string answers;
+  char chunk[4096];
+  for (ssize_t n; (n = read(fds[0], chunk, sizeof(chunk))) > 0;) {
+    answers.append(chunk, n);
+  }
+  close(fds[0]);
+  std::istringstream input(answers);
+  std::map<std::string, std::pair<std::string, std::string>> by_id;
+  std::string id, status;
+  long queue_ns, solve_ns;
+  size_t length;
+  while (input >> id >> status >> queue_ns >> solve_ns >> length) {
+    ASSERT_GE(queue_ns, 0);
+    ASSERT_GE(solve_ns, 0);
+    input.get();
+    std::string text(length, ' ');
+    input.read(text.data(), length);
+    by_id[id] = {status, text};
+  }
+  ASSERT_EQ(by_id.size(), 8);
+  std::istringstream unique_input(unique);
+  std::ostringstream expected;
+  print_solution(expected, solve_puzzle(read_puzzle(unique_input)));
+  ASSERT_EQ(by_id["a"], std::pair(std::string("solved"), expected.str()));
+  ASSERT_EQ(by_id["d"], by_id["a"]);
+  ASSERT_EQ(by_id["b"].first, "unsolvable");
+  for (auto id : {"c", "e", "f", "g", "-"}) {
+    ASSERT_EQ(by_id[id].first, "error");
+  }
+}
+
+TEST(TestSolver, TestCountSolutions) {
+  // a 2x2 grid with one cell per line has two solutions, the diagonals
+  std::istringstream two("2 2\n1\n1\n1\n1\n");
+  auto puzzle = read_puzzle(two);
+  SolverStats stats;
+  auto result = count_solutions(puzzle, 10, {}, stats);
+  ASSERT_EQ(result.m_count, 2);
+  ASSERT_EQ(result.m_witnesses.size(), 2);
+  for (const auto &witness : result.m_witnesses) {
+    ASSERT_TRUE(witness.m_is_final);
+    ASSERT_TRUE(satisfies_rules(puzzle, witness));
+  }
+  ASSERT_NE(result.m_witnesses[0].get_cell(0, 0),
+            result.m_witnesses[1].get_cell(0, 0));
+  ASSERT_EQ(count_solutions(puzzle, 1, {}, stats).m_count, 1);
+
+  std::istringstream unique("3 3\n3\n1\n3\n3\n1 1\n1 1\n");
+  ASSERT_EQ(count_solutions(read_puzzle(unique), 2, {}, stats).m_count, 1);
+  std::istringstream none("1 1\n1\n\n");
+  auto unsolvable = count_solutions(read_puzzle(none), 2, {}, stats);
+  ASSERT_EQ(unsolvable.m_count, 0);
+  ASSERT_TRUE(unsolvable.m_witnesses.empty());
+}
+
+TEST(TestLearning, TestConflictFollowsFromItsDecisions) {
+  std::istringstream input("5 5\n1\n1\n1\n1\n1\n1\n1\n1\n1\n1\n");
+  auto puzzle = read_puzzle(input);
+  Solution solution(puzzle.m_width, puzzle.m_height, puzzle.m_vertical_rules,
+                    puzzle.m_horizontal_rules);
+  Nogoods nogoods(10, puzzle.m_width, puzzle.m_height);
+  SolverContext context{.m_nogoods = &nogoods};
+  SolverStats stats;
+  solution.start_recording();
+  ASSERT_TRUE(propagate(puzzle, solution, stats, context));
+  std::vector<size_t> marks;
+  for (auto [i, j] : {std::pair(4, 4), std::pair(1, 1)}) {
+    marks.push_back(solution.m_trail.mark());
+    solution.set_cell(i, j, Cell::FILLED, Trail::kDecision);
+    ASSERT_TRUE(propagate(puzzle, solution, stats, context));
+  }
+  // filling (3, 3) fills (1, 2) too, which row 1 has emptied since (1, 1)
+  // was filled, whatever (4, 4) holds
+  std::vector<Nogoods::Literal> literals{{3, 3, Cell::FILLED},
+                                         {1, 2, Cell::EMPTY}};
+  ASSERT_TRUE(nogoods.add(literals));
+  marks.push_back(solution.m_trail.mark());
+  solution.set_cell(3, 3, Cell::FILLED, Trail::kDecision);
+  ASSERT_FALSE(propagate(puzzle, solution, stats, context));
+  ASSERT_EQ(solution.m_conflict, Trail::kFirstNogood);
+  ConflictAnalysis analysis(solution);
+  ASSERT_EQ(analysis.decisions(solution, marks, nogoods),
+            (std::vector<int>{1, 2}));
+
+  solution.undo_to(marks[1]);
+  solution.set_cell(3, 3, Cell::FILLED, Trail::kDecision);
+  SolverStats nogood_stats;
+  ASSERT_TRUE(nogoods.propagate(solution, nogood_stats));
+  ASSERT_EQ(solution.get_cell(1, 2), Cell::FILLED);
+  ASSERT_EQ(nogood_stats.m_nogood_fixed_cells, 1);
+}
+
+TEST(TestLearning, TestLearningKeepsSolutions) {
+  GeneratorOptions options{.m_width = 20, .m_height = 20, .m_density = 0.5};
+  std::mt19937_64 rng(2);
+  SolverStats learning_stats;
+  for (int k = 0; k < 12; ++k) {
+    auto puzzle = generate_puzzle(options, rng);
+    SolverStats stats;
+    auto expected = count_solutions(puzzle, 3, {}, stats);
+    auto counted =
+        count_solutions(puzzle, 3, {.m_learning = true}, learning_stats);
+    ASSERT_EQ(counted.m_count, expected.m_count);
+    for (const auto &witness : counted.m_witnesses) {
+      ASSERT_TRUE(satisfies_rules(puzzle, witness));
+    }
+    auto solution = solve_puzzle(puzzle, {.m_learning = true}, learning_stats);
+    ASSERT_TRUE(solution.m_is_final);
+    ASSERT_TRUE(satisfies_rules(puzzle, solution));
+  }
+  ASSERT_GT(learning_stats.m_nogoods, 0);
+  ASSERT_GT(learning_stats.m_backjumped_levels, 0);
+}
+
+TEST(TestSolver, TestBudgetStopsAtRootFixpoint) {
+  // propagation fixes the last two columns and the last row, leaving the two
+  // diagonals of the top-left 2x2 square to search
+  std::istringstream input("4 3\n1\n1\n\n3\n1 1\n1 1\n1\n");
+  auto puzzle = read_puzzle(input);
+  Solution fixpoint(puzzle.m_width, puzzle.m_height, puzzle.m_vertical_rules,
+                    puzzle.m_horizontal_rules);
+  ASSERT_TRUE(propagate(puzzle, fixpoint));
+
+  for (int search_threads : {1, 2}) {
+    SolverStats stats;
+    auto solution = solve_puzzle(
+        puzzle, {.m_search_threads = search_threads, .m_node_limit = 1},
+        stats);
+    ASSERT_EQ(solution.m_status, SolveStatus::TIMED_OUT);
+    ASSERT_FALSE(solution.m_is_final);
+    for (int i = 0; i < puzzle.m_height; ++i) {
+      for (int j = 0; j < puzzle.m_width; ++j) {
+        ASSERT_EQ(solution.get_cell(i, j), fixpoint.get_cell(i, j));
+        ASSERT_EQ(solution.get_cell(i, j) == Cell::UNKNOWN, i < 2 && j < 2);
+      }
+    }
+  }
+
+  SolverStats stats;
+  auto counted = count_solutions(puzzle, 2, {.m_node_limit = 2}, stats);
+  ASSERT_TRUE(counted.m_timed_out);
+  ASSERT_LT(counted.m_count, 2);
+  counted = count_solutions(puzzle, 2, {.m_node_limit = 100}, stats);
+  ASSERT_FALSE(counted.m_timed_out);
+  ASSERT_EQ(counted.m_count, 2);
+
+  std::istringstream none("1 1\n1\n\n");
+  ASSERT_EQ(solve_puzzle(read_puzzle(none), {}, stats).m_status,
+            SolveStatus::UNSOLVABLE);
+}
+
+TEST(TestPuzzleParser, TestParsesConcatenatedPuzzles) {
+  std::string data = "5 5\n2 1\n2 1\n1\n2 1\n2 1\n2 2\n2 2\n\n1 1\n3\n"
+                     "\n\n2 1\r\n 1 \r\n\t1\r\n2";
+  PuzzleParser parser(data);
+  std::istringstream stream(data);
+  for (int k = 0; k < 2; ++k) {
+    auto parsed = parser.next();
+    auto expected = read_next_puzzle(stream);
+    ASSERT_TRUE(parsed.has_value());
+    ASSERT_EQ(parsed->m_width, expected->m_width);
+    ASSERT_EQ(parsed->m_height, expected->m_height);
+    ASSERT_EQ(parsed->m_vertical_rules, expected->m_vertical_rules);
+    ASSERT_EQ(parsed->m_horizontal_rules, expected->m_horizontal_rules);
+  }
+  ASSERT_FALSE(parser.next().has_value());
+}
+
+TEST(TestPuzzleParser, TestErrorsHaveLineNumbers) {
+  auto error_line = [](std::string_view data) {
+    try {
+      PuzzleParser parser(data);
+      while (parser.next().has_value()) {
+      }
+    } catch (const ParseError &e) {
+      return e.m_line;
+    }
+    return 0;
+  };
+  ASSERT_EQ(error_line("2 1\n1\n1\n1\n"), 0);
+  ASSERT_EQ(error_line("\n2\n"), 2);
+  ASSERT_EQ(error_line("2 1\n1\nx\n1\n"), 3);
+  ASSERT_EQ(error_line("2 1\n1\n1\n1 1\n"), 4);
+  ASSERT_EQ(error_line("2 1\n1\n1\n1\n\n1 1\n0\n\n"), 7);
+  ASSERT_EQ(error_line("2 1\n1\n1\n"), 4);
+}
+
+TEST(TestPuzzleParser, TestStreamReaderRejectsStrayLines) {
+  // a second row "2" left over from a miscounted puzzle
+  std::istringstream input("2 1\n1\n1\n1\n2\n1 1\n1\n1\n");
+  int line_no = 1;
+  ASSERT_TRUE(read_next_puzzle(input, &line_no).has_value());
+  try {
+    read_next_puzzle(input, &line_no);
+    FAIL();
+  } catch (const ParseError &e) {
+    ASSERT_EQ(e.m_line, 5);
+  }
+  std::istringstream blank(" \t\r\n\n1 1\n1\n1\n");
+  ASSERT_EQ(read_next_puzzle(blank)->m_width, 1);
+
+  // rules are checked like PuzzleParser checks them
+  auto error_line = [](const std::string &text) {
+    std::istringstream stream(text);
+    int line_no = 1;
+    try {
+      while (read_next_puzzle(stream, &line_no)) {
+      }
+    } catch (const ParseError &e) {
+      return e.m_line;
+    }
+    return 0;
+  };
+  ASSERT_EQ(error_line("3 1\n1\n1\n1\n0 -3 1\n"), 5);
+  ASSERT_EQ(error_line("1 3\n5\n1\n1\n1\n"), 2);
+  ASSERT_EQ(error_line("3 3\n3\n"), 3);
+  ASSERT_EQ(error_line("3 1\n1\n1\n1\n1 x 1\n"), 5);
+  ASSERT_EQ(error_line("1 1\n1\n1\n\n3 3\n1\n1\n1\n1\n1\n"), 11);
+}
+
+TEST(TestBinaryFormat, TestPuzzlesRoundTrip) {
+  // the last puzzle has a rule of two varint bytes
+  std::string tall = "1 200\n200\n";
+  for (int i = 0; i < 200; ++i) {
+    tall += "1\n";
+  }
+  std::istringstream input("5 5\n2 1\n2 1\n1\n2 1\n2 1\n2 2\n2 2\n\n1 1\n3\n"
+                           "3 1\n1\n\n1\n1 1\n" +
+                           tall);
+  std::vector<Puzzle> puzzles;
+  while (auto puzzle = read_next_puzzle(input)) {
+    puzzles.push_back(puzzle.value());
+  }
+  std::ostringstream output;
+  BinaryWriter writer(output, BinaryKind::PUZZLES);
+  for (const auto &puzzle : puzzles) {
+    writer.add(puzzle);
+  }
+  writer.finish();
+
+  auto data = output.str();
+  ASSERT_TRUE(is_binary(data, BinaryKind::PUZZLES));
+  BinaryReader reader(data, BinaryKind::PUZZLES);
+  ASSERT_EQ(reader.size(), puzzles.size());
+  // random access, last puzzle first
+  for (int n = puzzles.size() - 1; n >= 0; --n) {
+    auto puzzle = reader.puzzle(n);
+    ASSERT_EQ(puzzle.m_width, puzzles[n].m_width);
+    ASSERT_EQ(puzzle.m_height, puzzles[n].m_height);
+    ASSERT_EQ(puzzle.m_vertical_rules, puzzles[n].m_vertical_rules);
+    ASSERT_EQ(puzzle.m_horizontal_rules, puzzles[n].m_horizontal_rules);
+  }
+  ASSERT_THROW(BinaryReader(data.substr(0, data.size() - 1),
+                            BinaryKind::PUZZLES),
+               BinaryFormatError);
+  ASSERT_THROW(BinaryReader(data, BinaryKind::SOLUTIONS), BinaryFormatError);
+}
+
+TEST(TestBinaryFormat, TestMalformedPuzzleRecordsThrow) {
+  // file holding one puzzle record of the given varint bytes
+  auto file_with_record = [](std::initializer_list<unsigned> bytes) {
+    std::string data("NGPZ\x01\0\0\0", 8);
+    for (auto byte : bytes) {
+      data.push_back(static_cast<char>(byte));
+    }
+    auto put_u64 = [&](std::uint64_t value) {
+      for (int k = 0; k < 8; ++k) {
+        data.push_back(static_cast<char>(value >> (8 * k)));
+      }
+    };
+    auto index_offset = data.size();
+    put_u64(8);
+    put_u64(1);
+    put_u64(index_offset);
+    return data;
+  };
+  auto read = [](const std::string &data) {
+    return BinaryReader(data, BinaryKind::PUZZLES).puzzle(0);
+  };
+  // 3x1 puzzle with columns "1", "", "1" and row "1 1"
+  ASSERT_EQ(read(file_with_record({3, 1, 1, 1, 0, 1, 1, 2, 1, 1})).m_width, 3);
+  // a column rule longer than the column
+  ASSERT_THROW(read(file_with_record({3, 1, 1, 2, 0, 1, 1, 2, 1, 1})),
+               BinaryFormatError);
+  // a row of two rules of INT_MAX
+  ASSERT_THROW(read(file_with_record({3, 1, 1, 1, 0, 1, 1, 2, 0xff, 0xff,
+                                      0xff, 0xff, 0x07, 0xff, 0xff, 0xff,
+                                      0xff, 0x07})),
+               BinaryFormatError);
+  // width 2000000000
+  ASSERT_THROW(read(file_with_record({0x80, 0x94, 0xeb, 0xdc, 0x07, 1})),
+               BinaryFormatError);
+  // a byte after the last row
+  ASSERT_THROW(read(file_with_record({3, 1, 1, 1, 0, 1, 1, 2, 1, 1, 0})),
+               BinaryFormatError);
+}
+
+TEST(TestBinaryFormat, TestSolutionsRoundTrip) {
+  std::istringstream input("3 3\n3\n1\n3\n3\n1 1\n1 1\n");
+  auto puzzle = read_puzzle(input);
+  auto solution = solve_puzzle(puzzle);
+  Solution unsolved(puzzle.m_width, puzzle.m_height, puzzle.m_vertical_rules,
+                    puzzle.m_horizontal_rules);
+  std::ostringstream output;
+  BinaryWriter writer(output, BinaryKind::SOLUTIONS);
+  writer.add(solution);
+  writer.add(unsolved);
+  writer.finish();
+
+  auto data = output.str();
+  BinaryReader reader(data, BinaryKind::SOLUTIONS);
+  ASSERT_EQ(reader.size(), 2);
+  auto grid = reader.solution(0);
+  ASSERT_TRUE(grid.m_solved);
+  for (int i = 0; i < puzzle.m_height; ++i) {
+    for (int j = 0; j < puzzle.m_width; ++j) {
+      ASSERT_EQ(grid.m_rows[i][j], solution.get_cell(i, j));
+    }
+  }
+  ASSERT_FALSE(reader.solution(1).m_solved);
+}
+
+TEST(TestGenerator, TestGeneratedPuzzlesAreReproducibleAndSolvable) {
+  GeneratorOptions options{.m_width = 12, .m_height = 9, .m_density = 0.6};
+  std::mt19937_64 rng(5);
+  std::mt19937_64 same_rng(5);
+  for (int k = 0; k < 5; ++k) {
+    auto puzzle = generate_puzzle(options, rng);
+    auto same = generate_puzzle(options, same_rng);
+    ASSERT_EQ(puzzle.m_vertical_rules, same.m_vertical_rules);
+    ASSERT_EQ(puzzle.m_horizontal_rules, same.m_horizontal_rules);
+    auto solution = solve_puzzle(puzzle);
+    ASSERT_TRUE(solution.m_is_final);
+    ASSERT_TRUE(satisfies_rules(puzzle, solution));
+  }
+
+  options.m_density = 1;
+  auto full = generate_puzzle(options, rng);
+  ASSERT_EQ(full.m_horizontal_rules[0], RulesLine({12}));
+  ASSERT_EQ(full.m_vertical_rules[0], RulesLine({9}));
+}
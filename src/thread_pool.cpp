@@ -0,0 +1,75 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <latch>
+
+ThreadPool::ThreadPool(int n_threads) {
+  for (int i = 0; i < n_threads; ++i) {
+    m_workers.emplace_back([this] { worker_loop(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard lock(m_mutex);
+    m_stopping = true;
+  }
+  m_available.release(m_workers.size());
+  for (auto &worker : m_workers) {
+    worker.join();
+  }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+  {
+    std::lock_guard lock(m_mutex);
+    m_tasks.push_back(std::move(task));
+  }
+  m_available.release();
+}
+
+void ThreadPool::parallel_for(int n, const std::function<void(int)> &fn) {
+  int n_helpers = std::min(size(), n - 1);
+  if (n_helpers <= 0) {
+    for (int k = 0; k < n; ++k) {
+      fn(k);
+    }
+    return;
+  }
+
+  std::atomic<int> next{0};
+  std::latch helpers_done(n_helpers);
+  auto run = [&] {
+    for (int k = next.fetch_add(1); k < n; k = next.fetch_add(1)) {
+      fn(k);
+    }
+  };
+  for (int i = 0; i < n_helpers; ++i) {
+    submit([&] {
+      run();
+      helpers_done.count_down();
+    });
+  }
+  run();
+  helpers_done.wait();
+}
+
+void ThreadPool::worker_loop() {
+  while (true) {
+    m_available.acquire();
+    std::function<void()> task;
+    {
+      std::lock_guard lock(m_mutex);
+      if (m_tasks.empty()) {
+        // queued tasks are drained before the shutdown releases
+        assert(m_stopping);
+        return;
+      }
+      task = std::move(m_tasks.front());
+      m_tasks.pop_front();
+    }
+    task();
+  }
+}